@@ -3,6 +3,20 @@
 #endif /* PY_SSIZE_T_CLEAN */
 
 #include <Python.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MODDICT_USE_X86SIMD  1
+#include <immintrin.h>
+#else
+#define MODDICT_USE_X86SIMD  0
+#endif
 
 #if PY_VERSION_HEX >= 0x03090000
 #include <genericaliasobject.h>
@@ -10,9 +24,24 @@
 #ifndef Py_TPFLAGS_MAPPING
 #define Py_TPFLAGS_MAPPING  0
 #endif
+#ifndef Py_TPFLAGS_IMMUTABLETYPE
+#define Py_TPFLAGS_IMMUTABLETYPE  0
+#endif
+#ifndef Py_TPFLAGS_DISALLOW_INSTANTIATION
+#define Py_TPFLAGS_DISALLOW_INSTANTIATION  0
+#endif
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op)  {
+#define Py_END_CRITICAL_SECTION()      }
+#endif
 
 #define MODDICT_USE_SUPER       0
+/* the digits of an int are only reachable before 3.12 */
+#if PY_VERSION_HEX < 0x030C0000
 #define MODDICT_USE_LONGOBJECT  1
+#else
+#define MODDICT_USE_LONGOBJECT  0
+#endif
 
 /*
  *
@@ -54,7 +83,7 @@ inline static void
 SetNULL(void **buffer)
 {
     void *p = *buffer;
-    buffer = NULL;
+    *buffer = NULL;
 
     PyMem_Free(p);
 }
@@ -115,15 +144,54 @@ SetKeyError(PyObject *key)
  * Object: ModDict
  */
 
+#if defined(__SIZEOF_INT128__)
+#define MODDICT_USE_FASTMOD  1
+#else
+#define MODDICT_USE_FASTMOD  0
+#endif
+
+typedef struct ModDictDivider {
+    digit divisor;
+    uint32_t magic;
+    uint32_t shift;
+    uint32_t mulshift;
+    uint64_t multiplier;
+#if MODDICT_USE_FASTMOD
+    uint64_t fastmod;
+    __uint128_t fastmod64;
+#endif
+} ModDictDivider;
+
+typedef struct ModDictBucket {
+#if MODDICT_USE_FASTMOD
+    uint64_t fastmod;
+#endif
+    digit divisor;
+    digit offset;
+} ModDictBucket;
+
 typedef struct ModDictObject {
     PyObject_HEAD
-    PyObject *dict;
     digit divisor;
+    ModDictDivider div;
     PyObject *divisor_;
-    PyObject *keys;
     PyObject *values;
-    digit *remainder;
-    digit *rem_keys;
+    PyObject *keys;
+    void *numbers;
+    int value_itemsize;
+    void *remainder;
+    void *rem_keys;
+    int key_itemsize;
+    ModDictBucket *buckets;
+    digit *order;
+    digit table_size;
+    Py_ssize_t size;
+    int rem_itemsize;
+    bool compact;
+    bool hashed;
+    uint32_t seed;
+    void *mapping;
+    size_t mapping_size;
 } ModDictObject;
 
 enum {
@@ -131,512 +199,4138 @@ enum {
     MODDICT_KEY_FAILED = -1,
 };
 
-typedef struct ModDictKeyInfo {
-    digit key;
-    digit rem;
-} ModDictKeyInfo;
+typedef struct ModDictParam {
+    int key_bits;
+    int hashed;
+    int64_t seed;
+    int threads;
+    int compact;
+    int levels;
+    int typed;
+    digit divisor;
+    double max_load;
+    double timeout;
+    int prefer;
+    int engine;
+    uint64_t multiplier;
+    digit divmin;
+} ModDictParam;
+
+enum {
+    MODDICT_PREFER_ANY,
+    MODDICT_PREFER_POW2,
+    MODDICT_PREFER_PRIME,
+};
+
+enum {
+    MODDICT_ENGINE_MOD,
+    MODDICT_ENGINE_MUL,
+};
+
+static const ModDictParam ModDictParam_default = {
+    .key_bits = 32,
+    .hashed = false,
+    .seed = -1,
+    .threads = 1,
+    .compact = false,
+    .levels = 1,
+    .typed = -1,
+    .divisor = 0,
+    .max_load = 0,
+    .timeout = 0,
+    .prefer = MODDICT_PREFER_ANY,
+    .engine = MODDICT_ENGINE_MOD,
+    .multiplier = 0,
+    .divmin = 0,
+};
+
+/*
+ * collision buffer entry for 64 remainders: keys holds the keys that are
+ * their own remainder, marks the remainders taken in the current test
+ */
+typedef struct fdivcnt_t {
+    uint64_t keys;
+    uint64_t marks;
+} fdivcnt_t;
 
-typedef uint8_t fdivcnt_t;
+#define FDIVCNT_BITS    64
+#define FDIVCNT_BIT(n)  ((uint64_t) 1 << ((n) % FDIVCNT_BITS))
 
 /* ******** */
 
-static PyTypeObject *get_moddict_type();
-#define ModDictType (get_moddict_type())
+/*
+ * Module state: each module object (one per interpreter) owns its heap
+ * types.  A ModDict never changes once built, so lookups take no lock.
+ */
+typedef struct ModDictState {
+    PyTypeObject *moddict_type;
+    PyTypeObject *iter_type;
+    PyTypeObject *view_types[3];    /* by MODDICT_ITEM_* */
+    PyTypeObject *table_type;
+} ModDictState;
 
+static ModDictState *ModDict_get_state(PyTypeObject *type);
+static void ModDict_dealloc(ModDictObject *self);
 
-static int
-ModDictKeyInfo_Compare(const void *a, const void *b)
+/*
+ * any ModDict, whichever module made it: the ModDict layout is on the
+ * tp_base chain of every subclass
+ */
+inline static bool
+ModDict_Check(PyObject *obj)
 {
-    return (((const ModDictKeyInfo *) a)->key -
-            ((const ModDictKeyInfo *) b)->key);
-}
+    PyTypeObject *type;
 
-static int64_t
-ModDict_find_divisor(digit divmax, Py_ssize_t dict_size, ModDictKeyInfo *keys)
-{
-    Py_ssize_t mod_gbsize, mod_gblen;
-    digit mod_gbstep = (1 << 10);
-    digit mod_gbcount, divgbcnt;
-    fdivcnt_t *mod_gbuf, *mod_gbnew;
-    digit divisor;
-    bool injective;
-
-    Py_ssize_t key_pos, key_mark, key_last;
-    digit key, rem;
-
-    mod_gbcount = (dict_size + mod_gbstep - 1) / mod_gbstep;
-    mod_gblen = mod_gbcount * mod_gbstep;
-    mod_gbsize = mod_gblen * sizeof(fdivcnt_t);
-    if (!(mod_gbuf = PyMem_Malloc(mod_gbsize)))
-        return -1;
-    memset(mod_gbuf, 0, mod_gbsize);
-
-    key_mark = -1;
-    key_last = 0;
-    for (divisor = (digit) dict_size; divisor <= divmax; divisor++) {
-        divgbcnt = divisor / mod_gbstep;
-        if (divgbcnt >= mod_gbcount) {
-            mod_gbcount = divgbcnt + 1;
-            mod_gblen = mod_gbcount * mod_gbstep;
-            mod_gbsize = mod_gblen * sizeof(fdivcnt_t);
-            if (!(mod_gbnew = PyMem_Realloc(mod_gbuf, mod_gbsize))) {
-                PyMem_Free(mod_gbuf);
-                return -1;
-            }
-            mod_gbuf = mod_gbnew;
-            memset(mod_gbuf + (mod_gblen - mod_gbstep), 0, mod_gbstep * sizeof(fdivcnt_t));
-        }
+    for (type = Py_TYPE(obj); type; type = type->tp_base) {
+        if (type->tp_dealloc == (destructor) ModDict_dealloc)
+            return true;
+    }
+    return false;
+}
 
-        for (key_pos = key_mark + 1; key_pos < key_last; key_pos++)
-            mod_gbuf[keys[key_pos].rem] = 0;
 
-        injective = true;
-        for (key_pos = key_mark + 1; key_pos < dict_size; key_pos++) {
-            key_last = key_pos;
-            key = keys[key_pos].key;
-            rem = key % divisor;
-            keys[key_pos].rem = rem;
-            if (mod_gbuf[rem]) {
-                injective = false;
-                break;
-            }
-            mod_gbuf[rem] = 1;
-            if (key < divisor)
-                key_mark = key_pos;
-        }
-        if (injective)
-            break;
-    }
+static int
+ModDict_compare_key(const void *a, const void *b)
+{
+    digit ka = *(const digit *) a;
+    digit kb = *(const digit *) b;
 
-    PyMem_Free(mod_gbuf);
-    return injective ? divisor : 0;
+    return (ka > kb) - (ka < kb);
 }
 
 static int
-ModDict_create_table(ModDictObject *self, PyObject *dict)
+ModDict_compare_key64(const void *a, const void *b)
 {
-    PyObject *dict_keys = NULL, *dict_vals = NULL;
-    PyObject *mod_keys = NULL, *mod_vals = NULL;
-    PyObject *idict = NULL, *key = NULL, *val = NULL;
-    PyObject *divisor_ = NULL;
+    uint64_t ka = *(const uint64_t *) a;
+    uint64_t kb = *(const uint64_t *) b;
 
-    digit divisor = 0, divmax, digmax;
-    digit *key_table = NULL;
-    digit *mod_table = NULL;
-    uint8_t *mod_gbuf = NULL;
-    digit *remainder = NULL;
-    digit *rem_keys = NULL;
+    return (ka > kb) - (ka < kb);
+}
 
-    ModDictKeyInfo *dict_keyidx = NULL;
+/*
+ * key arrays hold digit or uint64_t (key_bits=64) keys
+ */
+inline static uint64_t
+ModDict_key_of(const void *keys, int key_itemsize, Py_ssize_t pos)
+{
+    if (key_itemsize == sizeof(uint64_t))
+        return ((const uint64_t *) keys)[pos];
+    return ((const digit *) keys)[pos];
+}
 
-    Py_ssize_t dict_size = 0;
-    Py_ssize_t dict_pos, rem_pos, key_pos;
-    long long key_num;
-    int overflow;
-    int64_t fdivisor;
-    int res = -1;
+inline static void
+ModDict_set_key(void *keys, int key_itemsize, Py_ssize_t pos, uint64_t nkey)
+{
+    if (key_itemsize == sizeof(uint64_t))
+        ((uint64_t *) keys)[pos] = nkey;
+    else
+        ((digit *) keys)[pos] = (digit) nkey;
+}
 
-    digmax = 0xffffffff;
+/*
+ * Divider
+ */
 
-    SetNone(&self->dict);
-    self->divisor = 0;
-    SetNone(&self->divisor_);
-    SetNone(&self->keys);
-    SetNone(&self->values);
-    SetNull(&self->remainder);
-    SetNull(&self->rem_keys);
+/*
+ * Branch-free division by invariant integer (libdivide, "branchfree" u32):
+ *
+ *   q = mulhi(n, magic)
+ *   n / divisor = (((n - q) >> 1) + q) >> shift
+ *
+ * divisor 1 has no such form and is special-cased by the users.
+ */
+static void
+ModDictDivider_init(ModDictDivider *div, digit divisor)
+{
+    uint32_t log2d, rem, twice;
+    uint64_t magic;
 
-    if (!(dict_size = PyDict_Size(dict))) {
-        if (!(self->dict = PyDict_New()))
-            goto error;
-        return 0;
+    div->divisor = divisor;
+    div->magic = 0;
+    div->shift = 0;
+    div->mulshift = 0;
+    div->multiplier = 0;
+#if MODDICT_USE_FASTMOD
+    div->fastmod = divisor ? (~(uint64_t) 0 / divisor + 1) : 0;
+    div->fastmod64 = divisor ? (~(__uint128_t) 0 / divisor + 1) : 0;
+#endif
+    if (divisor <= 1)
+        return;
+    log2d = 31 - __builtin_clz(divisor);
+    if (!(divisor & (divisor - 1))) {
+        div->shift = log2d - 1;
+        return;
     }
-    if (dict_size > digmax)
-        goto type_error;
-    if (!(dict_keys = PyTuple_New(dict_size)))
-        goto error;
-    if (!(dict_vals = PyTuple_New(dict_size)))
-        goto error;
-    if (!(dict_keyidx = PyMem_Malloc(dict_size * sizeof(ModDictKeyInfo))))
-        goto error;
-    if (!(key_table = PyMem_Malloc(dict_size * sizeof(digit))))
-        goto error;
-    if (!(mod_table = PyMem_Malloc(dict_size * sizeof(digit))))
-        goto error;
+    magic = ((uint64_t) 1 << (32 + log2d)) / divisor;
+    rem = (uint32_t) (((uint64_t) 1 << (32 + log2d)) % divisor);
+    magic += magic;
+    twice = rem + rem;
+    if (twice >= divisor || twice < rem)
+        magic++;
+    div->magic = (uint32_t) (magic + 1);
+    div->shift = log2d;
+}
 
-    divmax = dict_size;
-    dict_pos = rem_pos = 0;
-    while (PyDict_Next(dict, &dict_pos, &key, &val)) {
-        if (!PyLong_CheckExact(key))
-            goto key_error;
-        key_num = PyLong_AsLongLongAndOverflow(key, &overflow);
-        if (overflow || (key_num < 0) || (key_num > digmax))
-            goto key_error;
-        divmax = Py_MAX(divmax, (digit) key_num);
-
-        dict_keyidx[rem_pos].key = key_num;
-        dict_keyidx[rem_pos].rem = 0;
-
-        PyTuple_SET_ITEM(dict_keys, rem_pos, IncRef(key));
-        PyTuple_SET_ITEM(dict_vals, rem_pos, IncRef(val));
-        key_table[rem_pos] = key_num;
-        key = val = NULL;
-        rem_pos++;
-    }
-    if (!divmax)
-        goto type_error;
+inline static digit
+ModDictDivider_mod(const ModDictDivider *div, digit n)
+{
+    uint32_t q, t;
 
-    qsort(dict_keyidx, dict_size, sizeof(ModDictKeyInfo), ModDictKeyInfo_Compare);
-    fdivisor = ModDict_find_divisor(divmax, dict_size, dict_keyidx);
-    if (fdivisor < 0)
-        goto error;
-    if (fdivisor == 0)
-        goto type_error;
-    divisor = (digit) fdivisor;
+    if (div->divisor <= 1)
+        return 0;
+    q = (uint32_t) (((uint64_t) n * div->magic) >> 32);
+    t = ((n - q) >> 1) + q;
+    return n - (t >> div->shift) * div->divisor;
+}
 
-    if (!(divisor_ = PyLong_FromUnsignedLong(divisor)))
-        goto error;
+/*
+ * Lookup remainder: Lemire's fastmod, two multiplications and no branch
+ * (divisor 1 gives fastmod 0).  Without 128-bit integers it falls back
+ * to the multiply/shift form above.
+ */
+inline static digit
+ModDictDivider_fastmod(const ModDictDivider *div, digit n)
+{
+#if MODDICT_USE_FASTMOD
+    uint64_t low = div->fastmod * n;
 
-    if (!(mod_keys = PyTuple_New(divisor)))
-        goto error;
-    for (key_pos = 0; key_pos < dict_size; key_pos++) {
-        rem_pos = key_table[key_pos] % divisor;
-        mod_table[key_pos] = rem_pos;
-        PyTuple_SET_ITEM(mod_keys, rem_pos,
-                         IncRef(PyTuple_GET_ITEM(dict_keys, key_pos)));
-    }
+    return (digit) (((__uint128_t) low * div->divisor) >> 64);
+#else
+    return ModDictDivider_mod(div, n);
+#endif
+}
 
-    if (!(mod_vals = PyTuple_New(divisor)))
-        goto error;
-    if (!(remainder = PyMem_Malloc(divisor * sizeof(digit))))
-        goto error;
-    for (rem_pos = 0; rem_pos < divisor; rem_pos++)
-        remainder[rem_pos] = divisor;
-    for (key_pos = 0; key_pos < dict_size; key_pos++) {
-        rem_pos = mod_table[key_pos];
-        val = PyTuple_GET_ITEM(dict_vals, key_pos);
-        PyTuple_SET_ITEM(mod_vals, rem_pos, IncRef(val));
-        remainder[rem_pos] = key_pos;
-    }
-    val = NULL;
+/*
+ * the same for 64-bit keys, with a 128-bit reciprocal: the high half of
+ * low * divisor is taken in two 64-bit multiplications
+ */
+inline static digit
+ModDictDivider_fastmod64(const ModDictDivider *div, uint64_t n)
+{
+#if MODDICT_USE_FASTMOD
+    __uint128_t low = div->fastmod64 * n;
+    __uint128_t mid = ((__uint128_t) (uint64_t) low * div->divisor) >> 64;
 
-    if (!(rem_keys = PyMem_Malloc(divisor * sizeof(digit))))
-        goto error;
-    for (rem_pos = 0; rem_pos < divisor; rem_pos++)
-        rem_keys[rem_pos] = ~0;
-    for (key_pos = 0; key_pos < dict_size; key_pos++)
-        rem_keys[mod_table[key_pos]] = PyLong_AsLongLong(PyTuple_GET_ITEM(dict_keys, key_pos));
+    return (digit) (((__uint128_t) (uint64_t) (low >> 64) * div->divisor + mid) >> 64);
+#else
+    return div->divisor ? (digit) (n % div->divisor) : 0;
+#endif
+}
 
-    if (!(idict = PyDict_New()))
-        goto error;
-    if (divisor) {
-        for (key_pos = 0; key_pos < dict_size; key_pos++) {
-            key = PyTuple_GET_ITEM(dict_keys, key_pos);
-            val = PyTuple_GET_ITEM(dict_vals, key_pos);
-            if (PyDict_SetItem(idict, IncRef(key), IncRef(val)) < 0)
-                goto error;
-            ClearObject(&key);
-            ClearObject(&val);
-        }
-    }
+/*
+ * Multiply-shift (engine='mul')
+ *
+ * The slot of a key is the top bits of key * multiplier: for 32-bit
+ * keys (uint32_t) (key * M) >> (32 - bits), for 64-bit keys
+ * (key * M) >> (64 - bits), in a table of 2^bits slots.  A 32-bit M is
+ * kept shifted into the upper half, so both are (key * multiplier) >>
+ * (64 - bits) in 64-bit arithmetic.
+ */
+static void
+ModDictDivider_init_multiply(ModDictDivider *div, int bits, uint64_t multiplier,
+                             int key_itemsize)
+{
+    ModDictDivider_init(div, (digit) 1 << bits);
+    div->multiplier = (key_itemsize == sizeof(digit)) ? multiplier << 32 : multiplier;
+    div->mulshift = 64 - bits;
+}
 
-    self->dict = idict;
-    self->divisor = divisor;
-    self->divisor_ = divisor_;
-    self->keys = mod_keys;
-    self->values = mod_vals;
-    self->remainder = remainder;
-    self->rem_keys = rem_keys;
+/*
+ * the multiplier as given to ModDict(multiplier=...)
+ */
+inline static uint64_t
+ModDictDivider_multiplier(const ModDictDivider *div, int key_itemsize)
+{
+    return (key_itemsize == sizeof(digit)) ? div->multiplier >> 32 : div->multiplier;
+}
 
-    res = 0;
-    goto success;
+/*
+ * Remainder kernels
+ *
+ * rems[i] = keys[i] % div->divisor, picked at module load by CPU dispatch.
+ */
 
-key_error:
-    PyErr_SetObject(PyExc_KeyError, key);
-    goto error;
-type_error:
-    PyErr_BadArgument();
-error:
-    Py_XDECREF(idict);
-    Py_XDECREF(divisor_);
-    Py_XDECREF(mod_keys);
-    Py_XDECREF(mod_vals);
-    PyMem_Free(remainder);
-    PyMem_Free(rem_keys);
-success:
-    Py_XDECREF(dict_keys);
-    Py_XDECREF(dict_vals);
-    Py_XDECREF(key);
-    Py_XDECREF(val);
-    PyMem_Free(dict_keyidx);
-    PyMem_Free(key_table);
-    PyMem_Free(mod_table);
-    PyMem_Free(mod_gbuf);
-    return res;
-}
+typedef void (*ModDict_remainder_func)(const digit *keys, digit *rems, Py_ssize_t count,
+                                       const ModDictDivider *div);
 
-static int
-ModDict_check_remainder(ModDictObject *self, PyObject *key)
+static void
+ModDict_remainder_scalar(const digit *keys, digit *rems, Py_ssize_t count,
+                         const ModDictDivider *div)
 {
-    PyLongObject *lkey = (PyLongObject *) key;
-    long long ikey;
-    digit rem, nkey;
-    int overflow;
+    Py_ssize_t pos;
 
-    if (MODDICT_USE_LONGOBJECT) {
-        if (Py_SIZE(key) < 1)
-            return MODDICT_KEY_FAILED;
-        if (Py_SIZE(key) > 2)
-            return MODDICT_KEY_FAILED;
-        nkey = lkey->ob_digit[0];
-        if (Py_SIZE(key) == 2) {
-            ikey = nkey | (lkey->ob_digit[1] << PyLong_SHIFT);
-            if ((ikey >> 32))
-                return MODDICT_KEY_FAILED;
-            nkey = (digit) ikey;
-        }
-        rem = nkey % self->divisor;
-        if (nkey != self->rem_keys[rem])
-            return MODDICT_KEY_FAILED;
-    }
-    else {
-        ikey = PyLong_AsLongLongAndOverflow(key, &overflow);
-        if (overflow)
-            return MODDICT_KEY_FAILED;
-        rem = ikey % self->divisor;
-        if (ikey != self->rem_keys[rem])
-            return MODDICT_KEY_FAILED;
-    }
-    return (int) rem;
+    for (pos = 0; pos < count; pos++)
+        rems[pos] = ModDictDivider_mod(div, keys[pos]);
 }
 
-inline static int
-ModDict_check_key(ModDictObject *self, PyObject *key)
+static void
+ModDict_remainder64(const uint64_t *keys, digit *rems, Py_ssize_t count,
+                    const ModDictDivider *div)
 {
-    if (!PyLong_CheckExact(key))
-        return MODDICT_KEY_ERROR;
-    if (!self->divisor)
-        return MODDICT_KEY_ERROR;
-    return ModDict_check_remainder(self, key);
-}
+    Py_ssize_t pos;
 
-inline static PyObject *
-ModDict_get_remainder_value(ModDictObject *self, int rem)
-{
-    return IncRef(PyTuple_GET_ITEM(self->values, rem));
+    for (pos = 0; pos < count; pos++)
+        rems[pos] = ModDictDivider_fastmod64(div, keys[pos]);
 }
 
-inline static PyObject *
-ModDict_get_value(ModDictObject *self, PyObject *key)
+#if MODDICT_USE_X86SIMD
+
+__attribute__((target("sse4.1")))
+static void
+ModDict_remainder_sse41(const digit *keys, digit *rems, Py_ssize_t count,
+                        const ModDictDivider *div)
 {
-    int rem = ModDict_check_key(self, key);
-    if (rem >= 0)
-        return ModDict_get_remainder_value(self, rem);
-    return SetKeyError(key);
+    const __m128i magic = _mm_set1_epi32((int) div->magic);
+    const __m128i divisor = _mm_set1_epi32((int) div->divisor);
+    const __m128i shift = _mm_cvtsi32_si128((int) div->shift);
+    __m128i n, even, odd, hi, t, q;
+    Py_ssize_t pos = 0;
+
+    if (div->divisor > 1) {
+        for (; pos + 4 <= count; pos += 4) {
+            n = _mm_loadu_si128((const __m128i *) (keys + pos));
+            even = _mm_srli_epi64(_mm_mul_epu32(n, magic), 32);
+            odd = _mm_mul_epu32(_mm_srli_epi64(n, 32), magic);
+            hi = _mm_blend_epi16(even, odd, 0xcc);
+            t = _mm_add_epi32(_mm_srli_epi32(_mm_sub_epi32(n, hi), 1), hi);
+            q = _mm_srl_epi32(t, shift);
+            _mm_storeu_si128((__m128i *) (rems + pos),
+                             _mm_sub_epi32(n, _mm_mullo_epi32(q, divisor)));
+        }
+    }
+    ModDict_remainder_scalar(keys + pos, rems + pos, count - pos, div);
 }
 
-static PyObject *
-ModDict_from_dict(PyObject *dict)
+__attribute__((target("avx2")))
+inline static __m256i
+ModDict_mod_avx2(__m256i n, __m256i magic, __m256i divisor, __m128i shift)
 {
-    PyTypeObject *type = ModDictType;
-    PyObject *newobj = NULL;
-    PyObject *kwargs = NULL;
-    PyObject *args = NULL;
-
-    if (!dict)
-        return NULL;
-    if (!(args = PyTuple_New(1)))
-        goto error;
-    if (!(kwargs = PyDict_New()))
-        goto error;
-    PyTuple_SET_ITEM(args, 0, IncRef(dict));
-    if (!(newobj = (type->tp_new)(type, args, kwargs)))
-        goto error;
-    if ((Py_TYPE(newobj)->tp_init)((PyObject *) newobj, args, kwargs) != 0)
-        goto error;
-    Py_XDECREF(args);
-    Py_XDECREF(kwargs);
-    return IncRef(newobj);
+    __m256i even, odd, hi, t, q;
 
-error:
-    Py_XDECREF(args);
-    Py_XDECREF(kwargs);
-    Py_XDECREF(newobj);
-    return NULL;
+    even = _mm256_srli_epi64(_mm256_mul_epu32(n, magic), 32);
+    odd = _mm256_mul_epu32(_mm256_srli_epi64(n, 32), magic);
+    hi = _mm256_blend_epi32(even, odd, 0xaa);
+    t = _mm256_add_epi32(_mm256_srli_epi32(_mm256_sub_epi32(n, hi), 1), hi);
+    q = _mm256_srl_epi32(t, shift);
+    return _mm256_sub_epi32(n, _mm256_mullo_epi32(q, divisor));
 }
 
-static PyObject *
-ModDict_create_dict(PyObject *iterable, PyObject *defval)
+__attribute__((target("avx2")))
+static void
+ModDict_remainder_avx2(const digit *keys, digit *rems, Py_ssize_t count,
+                       const ModDictDivider *div)
 {
-    PyObject *dict = NULL;
-    PyObject *it = NULL;
-    PyObject *key = NULL;
-    PyObject *val = NULL;
-    Py_ssize_t pos;
+    const __m256i magic = _mm256_set1_epi32((int) div->magic);
+    const __m256i divisor = _mm256_set1_epi32((int) div->divisor);
+    const __m128i shift = _mm_cvtsi32_si128((int) div->shift);
+    __m256i n;
+    Py_ssize_t pos = 0;
 
-    if (!(dict = PyDict_New()))
-        goto error;
-    if (!(it = PyObject_GetIter(iterable)))
-        goto error;
-    for (pos = 0; (key = PyIter_Next(it)); pos++) {
-        if (defval)
-            val = IncRef(defval);
-        else if (!(val = PyLong_FromSsize_t(pos)))
-            goto error;
-        if (PyDict_SetItem(dict, key, val) < 0)
-            goto error;
-        ClearObject(&key);
-        ClearObject(&val);
+    if (div->divisor > 1) {
+        for (; pos + 8 <= count; pos += 8) {
+            n = _mm256_loadu_si256((const __m256i *) (keys + pos));
+            _mm256_storeu_si256((__m256i *) (rems + pos),
+                                ModDict_mod_avx2(n, magic, divisor, shift));
+        }
     }
-    goto success;
-error:
-    ClearObject(&dict);
-success:
-    Py_XDECREF(key);
-    Py_XDECREF(val);
-    Py_XDECREF(it);
-    return dict;
+    ModDict_remainder_scalar(keys + pos, rems + pos, count - pos, div);
 }
 
-/* ******** */
-
-static int
-ModDict_init(ModDictObject *self, PyObject *args, PyObject *kwargs)
+/*
+ * membership of 8 keys at a time: remainders, a gather from rem_keys
+ * and a compare; the table must be indexable by signed 32-bit offsets
+ * returns the number of keys done (a multiple of 8)
+ */
+__attribute__((target("avx2")))
+static Py_ssize_t
+ModDict_contains_avx2(const ModDictDivider *div, const digit *rem_keys,
+                      const digit *keys, Py_ssize_t count, uint8_t *out, bool bitmap)
 {
-    static char *kwlist[] = { "iterable", "value", NULL, };
-
-    PyObject *iterable = NULL;
-    PyObject *value = NULL;
+    const __m256i magic = _mm256_set1_epi32((int) div->magic);
+    const __m256i divisor = _mm256_set1_epi32((int) div->divisor);
+    const __m128i shift = _mm_cvtsi32_si128((int) div->shift);
+    __m256i n, rem, found;
+    Py_ssize_t pos = 0, bit;
+    int mask;
 
-    PyObject *dict = NULL;
-    int result = -1;
+    if (div->divisor <= 1 || div->divisor > 0x7fffffff)
+        return 0;
+    for (; pos + 8 <= count; pos += 8) {
+        n = _mm256_loadu_si256((const __m256i *) (keys + pos));
+        rem = ModDict_mod_avx2(n, magic, divisor, shift);
+        found = _mm256_i32gather_epi32((const int *) rem_keys, rem, sizeof(digit));
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(found, n)));
+        if (bitmap)
+            out[pos >> 3] = (uint8_t) mask;
+        else {
+            for (bit = 0; bit < 8; bit++)
+                out[pos + bit] = (mask >> bit) & 1;
+        }
+    }
+    return pos;
+}
 
-    UNUSED(kwargs);
+#endif /* MODDICT_USE_X86SIMD */
 
-    self->dict = NULL;
-    self->divisor = 0;
-    self->divisor_ = NewNone();
-    self->keys = NewNone();
-    self->values = NewNone();
-    self->remainder = NULL;
-    self->rem_keys = NULL;
+typedef Py_ssize_t (*ModDict_contains_func)(const ModDictDivider *div, const digit *rem_keys,
+                                             const digit *keys, Py_ssize_t count,
+                                             uint8_t *out, bool bitmap);
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O",
-                                     kwlist, &iterable, &value))
-        return -1;
-    if (PyDict_Check(iterable))
-        dict = IncRef(iterable);
-    else if (!(dict = ModDict_create_dict(iterable, value)))
-        goto error;
-    result = ModDict_create_table(self, dict);
-error:
-    Py_XDECREF(dict);
-    return result;
-}
+static ModDict_remainder_func ModDict_remainder = ModDict_remainder_scalar;
+static ModDict_contains_func ModDict_contains_kernel = NULL;
+static pthread_once_t ModDict_kernel_once = PTHREAD_ONCE_INIT;
 
 static void
-ModDict_finalize(ModDictObject *self)
+ModDict_select_kernel(void)
 {
-    Py_XDECREF(self->dict);
+#if MODDICT_USE_X86SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        ModDict_remainder = ModDict_remainder_avx2;
+        ModDict_contains_kernel = ModDict_contains_avx2;
+    }
+    else if (__builtin_cpu_supports("sse4.1"))
+        ModDict_remainder = ModDict_remainder_sse41;
+#endif
+}
+
+/*
+ * Divisor search
+ *
+ * ModDictSearch holds the working set of one searcher.  keys are shared
+ * (sorted, read-only), rems and the collision buffer are private, so
+ * several searchers can run at once without the GIL.  64-bit keys
+ * (key_itemsize 8) go through ModDict_remainder64; the remainders and
+ * the collision buffer are the same for both.
+ *
+ * The collision buffer is a bitset, one bit per remainder, so it stays
+ * in cache for divisors in the millions.  A key below the divisor is its
+ * own remainder: those bits are set once as the buffer grows and kept
+ * in a plane of their own, so the marks of a test are cleared by plain
+ * word stores, or in one sweep when they outnumber the words.
+ */
+
+typedef struct ModDictSearch {
+    const void *keys;
+    int key_itemsize;
+    Py_ssize_t size;
+    digit *rems;
+    fdivcnt_t *gbuf;
+    Py_ssize_t gblen;           /* in remainders */
+    Py_ssize_t key_fill;        /* keys below are set in gbuf */
+    Py_ssize_t key_mark;
+    Py_ssize_t key_last;
+} ModDictSearch;
+
+#define MODDICT_SEARCH_GBSTEP  (1 << 12)
+#define MODDICT_SEARCH_BLOCK   16
+#define MODDICT_SEARCH_BLKMAX  256
+#define MODDICT_SEARCH_SWEEP   1
+
+/*
+ * sets the keys below gblen that are not set yet
+ */
+inline static uint64_t
+ModDictSearch_key(const ModDictSearch *search, Py_ssize_t pos)
+{
+    return ModDict_key_of(search->keys, search->key_itemsize, pos);
+}
+
+static void
+ModDictSearch_fill(ModDictSearch *search)
+{
+    fdivcnt_t *gbuf = search->gbuf;
+    Py_ssize_t key_pos;
+    uint64_t key;
+
+    for (key_pos = search->key_fill; key_pos < search->size; key_pos++) {
+        if ((key = ModDictSearch_key(search, key_pos)) >= (uint64_t) search->gblen)
+            break;
+        gbuf[key / FDIVCNT_BITS].keys |= FDIVCNT_BIT(key);
+    }
+    search->key_fill = key_pos;
+}
+
+inline static void
+ModDictSearch_remainder(const ModDictSearch *search, Py_ssize_t pos, Py_ssize_t count,
+                        const ModDictDivider *div)
+{
+    if (search->key_itemsize == sizeof(uint64_t))
+        ModDict_remainder64((const uint64_t *) search->keys + pos, search->rems + pos, count, div);
+    else
+        ModDict_remainder((const digit *) search->keys + pos, search->rems + pos, count, div);
+}
+
+/*
+ * clears the marks of the last test
+ */
+static void
+ModDictSearch_clear(ModDictSearch *search)
+{
+    fdivcnt_t *gbuf = search->gbuf;
+    const digit *rems = search->rems;
+    Py_ssize_t key_pos, key_last = search->key_last;
+    Py_ssize_t words = search->gblen / FDIVCNT_BITS;
+
+    key_pos = search->key_mark + 1;
+    if ((key_last - key_pos) * MODDICT_SEARCH_SWEEP > words) {
+        for (key_pos = 0; key_pos < words; key_pos++)
+            gbuf[key_pos].marks = 0;
+        return;
+    }
+    for (; key_pos < key_last; key_pos++)
+        gbuf[rems[key_pos] / FDIVCNT_BITS].marks = 0;
+}
+
+static int
+ModDictSearch_init(ModDictSearch *search, const void *keys, int key_itemsize, Py_ssize_t size)
+{
+    Py_ssize_t gbstep = MODDICT_SEARCH_GBSTEP;
+
+    search->keys = keys;
+    search->key_itemsize = key_itemsize;
+    search->size = size;
+    search->key_mark = -1;
+    search->key_last = 0;
+    search->gblen = ((size + gbstep - 1) / gbstep) * gbstep;
+    search->gbuf = PyMem_RawCalloc(search->gblen / FDIVCNT_BITS, sizeof(fdivcnt_t));
+    search->rems = PyMem_RawMalloc(size * sizeof(digit));
+    if (!search->gbuf || !search->rems) {
+        PyMem_RawFree(search->gbuf);
+        PyMem_RawFree(search->rems);
+        search->gbuf = NULL;
+        search->rems = NULL;
+        return -1;
+    }
+    search->key_fill = 0;
+    ModDictSearch_fill(search);
+    return 0;
+}
+
+static void
+ModDictSearch_fini(ModDictSearch *search)
+{
+    PyMem_RawFree(search->gbuf);
+    PyMem_RawFree(search->rems);
+    search->gbuf = NULL;
+    search->rems = NULL;
+}
+
+/*
+ * clears the marks of the last test and starts over with other keys
+ * (at most the size given to ModDictSearch_init)
+ */
+static void
+ModDictSearch_rebind(ModDictSearch *search, const void *keys, Py_ssize_t size)
+{
+    Py_ssize_t key_pos;
+
+    ModDictSearch_clear(search);
+    for (key_pos = 0; key_pos < search->key_fill; key_pos++)
+        search->gbuf[ModDictSearch_key(search, key_pos) / FDIVCNT_BITS].keys = 0;
+    search->keys = keys;
+    search->size = size;
+    search->key_fill = 0;
+    search->key_mark = -1;
+    search->key_last = 0;
+    ModDictSearch_fill(search);
+}
+
+/*
+ * returns: 1 = injective, 0 = collision, -1 = no memory
+ *
+ * divisor must not decrease between calls: keys below divisor stay
+ * marked in gbuf (key_mark) and are not cleared on the next call.
+ */
+static int
+ModDictSearch_test(ModDictSearch *search, digit divisor)
+{
+    Py_ssize_t gbstep = MODDICT_SEARCH_GBSTEP;
+    Py_ssize_t gblen;
+    fdivcnt_t *gbuf = search->gbuf;
+    digit *rems = search->rems;
+    Py_ssize_t key_pos, key_mark, key_size;
+    Py_ssize_t blk_pos, blk_end, blk_size;
+    ModDictDivider div;
+    fdivcnt_t *entry;
+    digit rem;
+
+    ModDictSearch_clear(search);
+    if ((Py_ssize_t) divisor >= search->gblen) {
+        gblen = ((Py_ssize_t) divisor / gbstep + 1) * gbstep;
+        if (!(gbuf = PyMem_RawRealloc(gbuf, gblen / FDIVCNT_BITS * sizeof(fdivcnt_t))))
+            return -1;
+        memset(gbuf + search->gblen / FDIVCNT_BITS, 0,
+               (gblen - search->gblen) / FDIVCNT_BITS * sizeof(fdivcnt_t));
+        search->gbuf = gbuf;
+        search->gblen = gblen;
+        ModDictSearch_fill(search);
+    }
+
+    /*
+     * Most divisors fail within the first few keys, so remainders are
+     * computed in blocks that start small and grow.  Keys below the
+     * divisor are already set in gbuf and only move key_mark.
+     */
+    ModDictDivider_init(&div, divisor);
+    key_mark = search->key_mark;
+    key_size = search->size;
+    blk_size = MODDICT_SEARCH_BLOCK;
+    for (blk_pos = key_mark + 1; blk_pos < key_size; blk_pos = blk_end) {
+        blk_end = Py_MIN(blk_pos + blk_size, key_size);
+        ModDictSearch_remainder(search, blk_pos, blk_end - blk_pos, &div);
+        for (key_pos = blk_pos; key_pos < blk_end; key_pos++) {
+            if (ModDictSearch_key(search, key_pos) < divisor) {
+                key_mark = key_pos;
+                continue;
+            }
+            rem = rems[key_pos];
+            entry = gbuf + rem / FDIVCNT_BITS;
+            if ((entry->keys | entry->marks) & FDIVCNT_BIT(rem)) {
+                search->key_mark = key_mark;
+                search->key_last = key_pos;
+                return 0;
+            }
+            entry->marks |= FDIVCNT_BIT(rem);
+        }
+        blk_size = Py_MIN(blk_size * 2, MODDICT_SEARCH_BLKMAX);
+    }
+    search->key_mark = key_mark;
+    search->key_last = key_size;
+    return 1;
+}
+
+#define MODDICT_SEARCH_CHUNK  64
+
+/*
+ * Search budget
+ *
+ * prefer limits the candidates to powers of two or primes, and the
+ * search gives up at deadline (CLOCK_MONOTONIC seconds, 0 = none); the
+ * clock is read once per MODDICT_SEARCH_CHUNK candidates.  start skips
+ * the divisors (or tables) below it, when resuming an earlier search.
+ */
+
+typedef struct ModDictBudget {
+    int prefer;
+    double deadline;
+    uint64_t start;
+} ModDictBudget;
+
+static double
+ModDict_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+inline static bool
+ModDictBudget_expired(const ModDictBudget *budget)
+{
+    return budget->deadline > 0 && ModDict_now() >= budget->deadline;
+}
+
+/*
+ * Miller-Rabin with bases 2, 7 and 61: exact below 4759123141
+ */
+static bool
+ModDict_is_prime(uint64_t number)
+{
+    static const digit bases[] = {2, 7, 61};
+    uint64_t odd, power, square, exponent;
+    int shift, round, base;
+
+    if (number < 2)
+        return false;
+    for (base = 0; base < 3; base++) {
+        if (number % bases[base] == 0)
+            return number == bases[base];
+    }
+    for (odd = number - 1, shift = 0; !(odd & 1); shift++)
+        odd >>= 1;
+    for (base = 0; base < 3; base++) {
+        power = 1;
+        square = bases[base];
+        for (exponent = odd; exponent; exponent >>= 1) {
+            if (exponent & 1)
+                power = power * square % number;
+            square = square * square % number;
+        }
+        if (power == 1 || power == number - 1)
+            continue;
+        for (round = 1; round < shift && power != number - 1; round++)
+            power = power * power % number;
+        if (power != number - 1)
+            return false;
+    }
+    return true;
+}
+
+static digit
+ModDict_next_prime(uint64_t number)
+{
+    for (number = Py_MAX(number, 2); number <= 0xffffffff; number++) {
+        if (ModDict_is_prime(number))
+            return (digit) number;
+    }
+    return 0;
+}
+
+inline static bool
+ModDict_is_candidate(uint64_t divisor, int prefer)
+{
+    if (prefer == MODDICT_PREFER_POW2)
+        return !(divisor & (divisor - 1));
+    if (prefer == MODDICT_PREFER_PRIME)
+        return ModDict_is_prime(divisor);
+    return true;
+}
+
+/*
+ * the first candidate from divisor on, above 0xffffffff if none
+ */
+static uint64_t
+ModDict_next_candidate(uint64_t divisor, int prefer)
+{
+    uint64_t prime;
+
+    if (prefer == MODDICT_PREFER_POW2) {
+        divisor = Py_MAX(divisor, 1);
+        return (uint64_t) 1 << (64 - __builtin_clzll(divisor) - !(divisor & (divisor - 1)));
+    }
+    if (prefer == MODDICT_PREFER_PRIME)
+        return (prime = ModDict_next_prime(divisor)) ? prime : (uint64_t) 0xffffffff + 1;
+    return divisor;
+}
+
+static int64_t
+ModDict_find_divisor_serial(digit divmax, Py_ssize_t dict_size, const void *keys,
+                            int key_itemsize, const ModDictBudget *budget)
+{
+    ModDictSearch search;
+    uint64_t divisor, count = 0;
+    int injective = 0;
+
+    if (ModDictSearch_init(&search, keys, key_itemsize, dict_size) < 0)
+        return -1;
+    divisor = Py_MAX((uint64_t) dict_size, budget->start);
+    for (divisor = ModDict_next_candidate(divisor, budget->prefer); divisor <= divmax;
+         divisor = ModDict_next_candidate(divisor + 1, budget->prefer)) {
+        if (++count % MODDICT_SEARCH_CHUNK == 0 && ModDictBudget_expired(budget))
+            break;
+        if ((injective = ModDictSearch_test(&search, (digit) divisor)) != 0)
+            break;
+    }
+    ModDictSearch_fini(&search);
+    if (injective < 0)
+        return -1;
+    return injective ? (int64_t) divisor : 0;
+}
+
+/*
+ * Parallel search
+ *
+ * Workers claim chunks of consecutive divisors in ascending order and
+ * lower the shared result when a chunk holds an injective divisor.
+ * A chunk is only skipped once its first divisor is not below the
+ * result, so every divisor below the result has been rejected and the
+ * outcome equals the serial search.
+ */
+
+typedef struct ModDictSearchShared {
+    const void *keys;
+    int key_itemsize;
+    Py_ssize_t size;
+    uint64_t divmax;
+    uint64_t next;
+    uint64_t found;
+    int nomem;
+    ModDictBudget budget;
+} ModDictSearchShared;
+
+static void *
+ModDict_find_divisor_worker(void *arg)
+{
+    ModDictSearchShared *shared = arg;
+    ModDictSearch search;
+    uint64_t start, last, divisor, found;
+    int injective;
+
+    if (ModDictSearch_init(&search, shared->keys, shared->key_itemsize, shared->size) < 0) {
+        __atomic_store_n(&shared->nomem, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    for (;;) {
+        start = __atomic_fetch_add(&shared->next, MODDICT_SEARCH_CHUNK, __ATOMIC_RELAXED);
+        if (start > shared->divmax)
+            break;
+        if (start >= __atomic_load_n(&shared->found, __ATOMIC_RELAXED))
+            break;
+        if (__atomic_load_n(&shared->nomem, __ATOMIC_RELAXED))
+            break;
+        if (ModDictBudget_expired(&shared->budget))
+            break;
+        last = Py_MIN(start + MODDICT_SEARCH_CHUNK - 1, shared->divmax);
+        for (divisor = start; divisor <= last; divisor++) {
+            if (divisor >= __atomic_load_n(&shared->found, __ATOMIC_RELAXED))
+                break;
+            if (!ModDict_is_candidate(divisor, shared->budget.prefer))
+                continue;
+            if ((injective = ModDictSearch_test(&search, (digit) divisor)) < 0) {
+                __atomic_store_n(&shared->nomem, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            if (injective) {
+                found = __atomic_load_n(&shared->found, __ATOMIC_RELAXED);
+                while (divisor < found &&
+                       !__atomic_compare_exchange_n(&shared->found, &found, divisor, false,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    ;
+                break;
+            }
+        }
+    }
+    ModDictSearch_fini(&search);
+    return NULL;
+}
+
+static int64_t
+ModDict_find_divisor_parallel(digit divmax, Py_ssize_t dict_size, const void *keys,
+                              int key_itemsize, int threads, const ModDictBudget *budget)
+{
+    ModDictSearchShared shared;
+    pthread_t *workers;
+    int started, pos;
+
+    shared.keys = keys;
+    shared.key_itemsize = key_itemsize;
+    shared.size = dict_size;
+    shared.divmax = divmax;
+    shared.next = Py_MAX((uint64_t) dict_size, budget->start);
+    shared.found = (uint64_t) divmax + 1;
+    shared.nomem = 0;
+    shared.budget = *budget;
+
+    if (!(workers = PyMem_RawMalloc((threads - 1) * sizeof(pthread_t))))
+        return -1;
+    for (started = 0; started < threads - 1; started++) {
+        if (pthread_create(&workers[started], NULL, ModDict_find_divisor_worker, &shared) != 0)
+            break;
+    }
+    ModDict_find_divisor_worker(&shared);
+    for (pos = 0; pos < started; pos++)
+        pthread_join(workers[pos], NULL);
+    PyMem_RawFree(workers);
+
+    if (shared.nomem)
+        return -1;
+    return (shared.found <= divmax) ? (int64_t) shared.found : 0;
+}
+
+/*
+ * keys: sorted, threads: number of searchers (the caller included)
+ * returns: the smallest injective candidate, any injective one found
+ * when the deadline passed in a parallel search, 0 = none
+ *
+ * Runs without the GIL.
+ */
+static int64_t
+ModDict_find_divisor(digit divmax, Py_ssize_t dict_size, const void *keys, int key_itemsize,
+                     int threads, const ModDictBudget *budget)
+{
+    uint64_t range = (uint64_t) divmax - Py_MAX((uint64_t) dict_size, budget->start) + 1;
+    uint64_t chunks = (range + MODDICT_SEARCH_CHUNK - 1) / MODDICT_SEARCH_CHUNK;
+
+    if ((uint64_t) threads > chunks)
+        threads = (int) chunks;
+    /* powers of two are too few to share out */
+    if (budget->prefer == MODDICT_PREFER_POW2)
+        threads = 1;
+    if (threads <= 1)
+        return ModDict_find_divisor_serial(divmax, dict_size, keys, key_itemsize, budget);
+    return ModDict_find_divisor_parallel(divmax, dict_size, keys, key_itemsize, threads, budget);
+}
+
+/*
+ * Two-level search
+ *
+ * The first-level modulus (a prime) splits the keys into buckets and
+ * each bucket gets the smallest divisor injective over its own keys.
+ * The slots of a bucket are [offset, offset + divisor); buckets without
+ * keys share one trailing slot that stays empty.
+ */
+
+#define MODDICT_BUCKET_LOAD      4
+#define MODDICT_BUCKET_ATTEMPTS  8
+
+static void
+ModDictBucket_init(ModDictBucket *bucket, digit divisor, digit offset)
+{
+#if MODDICT_USE_FASTMOD
+    bucket->fastmod = ~(uint64_t) 0 / divisor + 1;
+#endif
+    bucket->divisor = divisor;
+    bucket->offset = offset;
+}
+
+inline static digit
+ModDictBucket_fastmod(const ModDictBucket *bucket, digit n)
+{
+#if MODDICT_USE_FASTMOD
+    uint64_t low = bucket->fastmod * n;
+
+    return (digit) (((__uint128_t) low * bucket->divisor) >> 64);
+#else
+    return n % bucket->divisor;
+#endif
+}
+
+/*
+ * slot of a key: its remainder, or the bucket offset plus the remainder
+ * by the bucket divisor (only 32-bit keys have buckets), or its
+ * multiply-shift
+ */
+inline static Py_ssize_t
+ModDict_slot_of(const ModDictDivider *div, const ModDictBucket *buckets, uint64_t nkey)
+{
+    const ModDictBucket *bucket;
+
+    if (div->multiplier)
+        return (Py_ssize_t) ((nkey * div->multiplier) >> div->mulshift);
+    if ((nkey >> 32))
+        return ModDictDivider_fastmod64(div, nkey);
+    if (!buckets)
+        return ModDictDivider_fastmod(div, (digit) nkey);
+    bucket = &buckets[ModDictDivider_fastmod(div, (digit) nkey)];
+    return (Py_ssize_t) bucket->offset + ModDictBucket_fastmod(bucket, (digit) nkey);
+}
+
+/*
+ * keys: sorted
+ * returns: table size, 0 = over limit, no divisor or past the deadline,
+ *          -1 = no memory
+ */
+static int64_t
+ModDict_find_buckets(const ModDictDivider *bdiv, Py_ssize_t dict_size, const digit *keys,
+                     ModDictBucket *buckets, uint64_t limit, const ModDictBudget *budget)
+{
+    digit nbuckets = bdiv->divisor;
+    Py_ssize_t *start = NULL;
+    digit *bkeys = NULL;
+    ModDictSearch search;
+    Py_ssize_t key_pos, count;
+    uint64_t table_size = 0, divisor, divmax, tested = 0;
+    digit bucket;
+    bool empty = false;
+    int injective = 1;
+    int64_t res = -1;
+
+    if (!(start = PyMem_RawCalloc((Py_ssize_t) nbuckets + 1, sizeof(Py_ssize_t))))
+        return -1;
+    if (!(bkeys = PyMem_RawMalloc(dict_size * sizeof(digit))))
+        goto done;
+
+    /* bucket sort: keys stay sorted inside each bucket */
+    for (key_pos = 0; key_pos < dict_size; key_pos++)
+        start[ModDictDivider_fastmod(bdiv, keys[key_pos]) + 1]++;
+    for (bucket = 0; bucket < nbuckets; bucket++)
+        start[bucket + 1] += start[bucket];
+    for (key_pos = 0; key_pos < dict_size; key_pos++)
+        bkeys[start[ModDictDivider_fastmod(bdiv, keys[key_pos])]++] = keys[key_pos];
+    memmove(start + 1, start, nbuckets * sizeof(Py_ssize_t));
+    start[0] = 0;
+
+    /* after the sort: the search sets the keys it is given in its buffer */
+    if (ModDictSearch_init(&search, bkeys, sizeof(digit), dict_size) < 0)
+        goto done;
+
+    res = 0;
+    for (bucket = 0; bucket < nbuckets; bucket++) {
+        if (!(count = start[bucket + 1] - start[bucket])) {
+            empty = true;
+            continue;
+        }
+        ModDictSearch_rebind(&search, bkeys + start[bucket], count);
+        divmax = Py_MIN((uint64_t) bkeys[start[bucket + 1] - 1] + 1, 0xffffffff);
+        for (divisor = count; divisor <= divmax; divisor++) {
+            if (++tested % MODDICT_SEARCH_CHUNK == 0 && ModDictBudget_expired(budget)) {
+                injective = 0;
+                break;
+            }
+            if ((injective = ModDictSearch_test(&search, (digit) divisor)) != 0)
+                break;
+        }
+        if (injective <= 0) {
+            res = injective;
+            goto fini;
+        }
+        ModDictBucket_init(&buckets[bucket], (digit) divisor, (digit) table_size);
+        if ((table_size += divisor) > limit)
+            goto fini;
+    }
+    if (empty) {
+        for (bucket = 0; bucket < nbuckets; bucket++) {
+            if (start[bucket + 1] == start[bucket])
+                ModDictBucket_init(&buckets[bucket], 1, (digit) table_size);
+        }
+        table_size++;
+    }
+    if (table_size <= limit)
+        res = table_size;
+fini:
+    ModDictSearch_fini(&search);
+done:
+    PyMem_RawFree(start);
+    PyMem_RawFree(bkeys);
+    return res;
+}
+
+/*
+ * Tries a few first-level moduli for a table within
+ * MODDICT_BUCKET_LOAD slots per key, then takes the first that works.
+ * A max_load (slots per key, 0 = none) holds for every attempt, and
+ * the search ends with the last of them, or at the deadline.
+ *
+ * returns: first-level modulus, 0 = none, -1 = no memory
+ * Runs without the GIL.
+ */
+static int64_t
+ModDict_find_two_level(Py_ssize_t dict_size, const digit *keys, double max_load,
+                       const ModDictBudget *budget, ModDictBucket **rbuckets,
+                       digit *rtable_size)
+{
+    ModDictBucket *buckets = NULL;
+    ModDictDivider bdiv;
+    digit nbuckets;
+    uint64_t limit;
+    int64_t table_size;
+    int attempt;
+
+    nbuckets = (digit) dict_size;
+    for (attempt = 0; (nbuckets = ModDict_next_prime(nbuckets)) != 0; attempt++, nbuckets++) {
+        if ((max_load > 0 && attempt >= MODDICT_BUCKET_ATTEMPTS) ||
+            ModDictBudget_expired(budget))
+            break;
+        if (!(buckets = PyMem_RawMalloc(nbuckets * sizeof(ModDictBucket))))
+            return -1;
+        limit = 0xffffffff;
+        if (max_load > 0)
+            limit = Py_MIN(limit, (uint64_t) (dict_size * max_load));
+        else if (attempt < MODDICT_BUCKET_ATTEMPTS)
+            limit = Py_MIN(limit, (uint64_t) dict_size * MODDICT_BUCKET_LOAD);
+        ModDictDivider_init(&bdiv, nbuckets);
+        table_size = ModDict_find_buckets(&bdiv, dict_size, keys, buckets, limit, budget);
+        if (table_size < 0) {
+            PyMem_RawFree(buckets);
+            return -1;
+        }
+        if (table_size > 0) {
+            *rbuckets = buckets;
+            *rtable_size = (digit) table_size;
+            return nbuckets;
+        }
+        PyMem_RawFree(buckets);
+    }
+    return 0;
+}
+
+/*
+ * Checks a known divisor, or builds the buckets of a known first-level
+ * modulus, instead of searching.
+ *
+ * keys: 32-bit when levels is 2
+ * returns: divisor, 0 = not injective, -1 = no memory
+ * Runs without the GIL.
+ */
+static int64_t
+ModDict_verify_divisor(digit divisor, int levels, Py_ssize_t dict_size, const void *keys,
+                       int key_itemsize, ModDictBucket **rbuckets, digit *rtable_size)
+{
+    /* a known modulus is only checked, however long its buckets take */
+    const ModDictBudget unbounded = { .deadline = 0 };
+    ModDictBucket *buckets;
+    ModDictDivider bdiv;
+    ModDictSearch search;
+    int64_t table_size;
+    int injective;
+
+    if (levels == 2) {
+        if (!(buckets = PyMem_RawMalloc(divisor * sizeof(ModDictBucket))))
+            return -1;
+        ModDictDivider_init(&bdiv, divisor);
+        if ((table_size = ModDict_find_buckets(&bdiv, dict_size, keys, buckets,
+                                               0xffffffff, &unbounded)) <= 0) {
+            PyMem_RawFree(buckets);
+            return table_size;
+        }
+        *rbuckets = buckets;
+        *rtable_size = (digit) table_size;
+        return divisor;
+    }
+    if ((Py_ssize_t) divisor < dict_size)
+        return 0;
+    if (ModDictSearch_init(&search, keys, key_itemsize, dict_size) < 0)
+        return -1;
+    injective = ModDictSearch_test(&search, divisor);
+    ModDictSearch_fini(&search);
+    return (injective > 0) ? (int64_t) divisor : injective;
+}
+
+/*
+ * Multiply-shift search
+ *
+ * From the smallest table up, each size 2^bits first tries the mask
+ * (multiplier 2^(32 - bits), the low bits of the key) and then
+ * MODDICT_MULTIPLY_ATTEMPTS odd multipliers of a fixed sequence, so the
+ * same keys always give the same table.  A test stops at the first
+ * collision; random keys need about n^2 / 11 slots, dense keys fit the
+ * mask.
+ */
+
+#define MODDICT_MULTIPLY_ATTEMPTS  256
+#define MODDICT_MULTIPLY_MAXBITS   31
+
+inline static uint64_t
+ModDict_splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+/*
+ * multiplier: shifted as in ModDictDivider
+ * used: 2^(64 - shift) bits, all clear, and clear again on return
+ */
+static bool
+ModDict_test_multiplier(const void *keys, int key_itemsize, Py_ssize_t size,
+                        uint64_t multiplier, int shift, uint64_t *used)
+{
+    Py_ssize_t pos, end;
+    uint64_t slot;
+
+    for (end = 0; end < size; end++) {
+        slot = (ModDict_key_of(keys, key_itemsize, end) * multiplier) >> shift;
+        if (used[slot / 64] >> (slot % 64) & 1)
+            break;
+        used[slot / 64] |= (uint64_t) 1 << (slot % 64);
+    }
+    /* every bit set came from these keys */
+    for (pos = 0; pos < end; pos++) {
+        slot = (ModDict_key_of(keys, key_itemsize, pos) * multiplier) >> shift;
+        used[slot / 64] = 0;
+    }
+    return end == size;
+}
+
+/*
+ * tablemax: the largest table to try
+ * multiplier: the one to verify, 0 = search
+ * returns: table size, 0 = none within tablemax and budget, -1 = no memory
+ * Runs without the GIL.
+ */
+static int64_t
+ModDict_find_multiplier(uint64_t tablemax, Py_ssize_t dict_size, const void *keys,
+                        int key_itemsize, uint64_t multiplier, const ModDictBudget *budget,
+                        ModDictDivider *rdiv)
+{
+    uint64_t state = 0, mult, *used;
+    bool key32 = (key_itemsize == sizeof(digit));
+    int bits, attempt, attempts;
+    bool found = false;
+
+    tablemax = Py_MIN(tablemax, (uint64_t) 1 << MODDICT_MULTIPLY_MAXBITS);
+    for (bits = 1; ((uint64_t) 1 << bits) < Py_MAX((uint64_t) dict_size, budget->start); bits++)
+        ;
+    if (multiplier)
+        bits = 64 - __builtin_clzll(tablemax) - 1;
+    attempts = multiplier ? 0 : MODDICT_MULTIPLY_ATTEMPTS;
+    for (; !found && ((uint64_t) 1 << bits) <= tablemax; bits++) {
+        if (!(used = PyMem_RawCalloc(((size_t) 1 << bits) / 64 + 1, sizeof(uint64_t))))
+            return -1;
+        for (attempt = 0; attempt <= attempts; attempt++) {
+            if (attempt % MODDICT_SEARCH_CHUNK == 0 && ModDictBudget_expired(budget)) {
+                tablemax = 0;
+                break;
+            }
+            if (multiplier)
+                mult = key32 ? multiplier << 32 : multiplier;
+            else if (attempt == 0)
+                mult = (uint64_t) 1 << (64 - bits);
+            else
+                mult = key32 ? (ModDict_splitmix64(&state) | 1) << 32
+                             : (ModDict_splitmix64(&state) | 1);
+            if ((found = ModDict_test_multiplier(keys, key_itemsize, dict_size, mult,
+                                                 64 - bits, used)))
+                break;
+        }
+        PyMem_RawFree(used);
+        if (found)
+            ModDictDivider_init_multiply(rdiv, bits, key32 ? mult >> 32 : mult, key_itemsize);
+    }
+    return found ? (int64_t) rdiv->divisor : 0;
+}
+
+/*
+ * Key hashing
+ *
+ * hashed=True takes str and bytes keys: each one is hashed (wyhash,
+ * final version 4, over the UTF-8 of a str) to a number of the key width
+ * and the table is built over the hashes; a hit is checked against the
+ * key itself.  str and bytes hash with different seeds, and a seed under
+ * which two keys share a hash is replaced by the next one.
+ */
+
+#define MODDICT_HASH_SEEDS  16
+
+static const uint64_t ModDict_wysecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL,
+};
+
+inline static void
+ModDict_wymum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t) *a * *b;
+
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl, lo = t + (rm1 << 32);
+
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+inline static uint64_t
+ModDict_wymix(uint64_t a, uint64_t b)
+{
+    ModDict_wymum(&a, &b);
+    return a ^ b;
+}
+
+inline static uint64_t
+ModDict_wyr8(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline static uint64_t
+ModDict_wyr4(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t
+ModDict_wyhash(const uint8_t *p, size_t len, uint64_t seed)
+{
+    const uint64_t *secret = ModDict_wysecret;
+    uint64_t a, b, see1, see2;
+    size_t i = len;
+
+    seed ^= ModDict_wymix(seed ^ secret[0], secret[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (ModDict_wyr4(p) << 32) | ModDict_wyr4(p + ((len >> 3) << 2));
+            b = (ModDict_wyr4(p + len - 4) << 32) | ModDict_wyr4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else
+            a = b = 0;
+    }
+    else {
+        if (i >= 48) {
+            see1 = see2 = seed;
+            do {
+                seed = ModDict_wymix(ModDict_wyr8(p) ^ secret[1], ModDict_wyr8(p + 8) ^ seed);
+                see1 = ModDict_wymix(ModDict_wyr8(p + 16) ^ secret[2], ModDict_wyr8(p + 24) ^ see1);
+                see2 = ModDict_wymix(ModDict_wyr8(p + 32) ^ secret[3], ModDict_wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = ModDict_wymix(ModDict_wyr8(p) ^ secret[1], ModDict_wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = ModDict_wyr8(p + i - 16);
+        b = ModDict_wyr8(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    ModDict_wymum(&a, &b);
+    return ModDict_wymix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+/*
+ * hashes a str or bytes key to key_itemsize bytes;
+ * false if it is neither (or a str without UTF-8)
+ */
+static bool
+ModDict_hash_key(PyObject *key, uint32_t seed, int key_itemsize, uint64_t *nkey)
+{
+    const char *data;
+    Py_ssize_t len;
+    uint64_t hash;
+
+    if (PyBytes_CheckExact(key)) {
+        data = PyBytes_AS_STRING(key);
+        len = PyBytes_GET_SIZE(key);
+        hash = ModDict_wyhash((const uint8_t *) data, len, (uint64_t) seed << 1);
+    }
+    else if (PyUnicode_CheckExact(key)) {
+        if (!(data = PyUnicode_AsUTF8AndSize(key, &len))) {
+            PyErr_Clear();
+            return false;
+        }
+        hash = ModDict_wyhash((const uint8_t *) data, len, ((uint64_t) seed << 1) | 1);
+    }
+    else
+        return false;
+    if (key_itemsize == sizeof(digit))
+        hash = (digit) (hash ^ (hash >> 32));
+    *nkey = hash;
+    return true;
+}
+
+/*
+ * true if two str or bytes keys are the same key
+ */
+inline static bool
+ModDict_same_key(PyObject *a, PyObject *b)
+{
+    if (a == b)
+        return true;
+    if (Py_TYPE(a) != Py_TYPE(b))
+        return false;
+    if (PyBytes_CheckExact(a))
+        return (PyBytes_GET_SIZE(a) == PyBytes_GET_SIZE(b) &&
+                !memcmp(PyBytes_AS_STRING(a), PyBytes_AS_STRING(b), PyBytes_GET_SIZE(a)));
+    return !PyUnicode_Compare(a, b);
+}
+
+/*
+ * the tables of a loaded ModDict may live in its mapped save file
+ */
+static void
+ModDict_free_tables(ModDictObject *self)
+{
+    if (self->mapping) {
+        munmap(self->mapping, self->mapping_size);
+        self->mapping = NULL;
+        self->mapping_size = 0;
+        self->remainder = NULL;
+        self->rem_keys = NULL;
+        self->buckets = NULL;
+        self->numbers = NULL;
+        return;
+    }
+    SetNull(&self->remainder);
+    SetNull(&self->rem_keys);
+    SetNull(&self->numbers);
+    /* the search allocates buckets without the GIL */
+    PyMem_RawFree(self->buckets);
+    self->buckets = NULL;
+}
+
+static void
+ModDict_clear(ModDictObject *self)
+{
+    self->divisor = 0;
+    ModDictDivider_init(&self->div, 0);
+    SetNone(&self->divisor_);
+    SetNone(&self->values);
+    SetNone(&self->keys);
+    ModDict_free_tables(self);
+    SetNull(&self->order);
+    self->value_itemsize = 0;
+    self->table_size = 0;
+    self->size = 0;
+    self->rem_itemsize = sizeof(digit);
+    self->key_itemsize = sizeof(digit);
+    self->compact = false;
+    self->hashed = false;
+    self->seed = 0;
+}
+
+inline static uint64_t
+ModDict_key_at(ModDictObject *self, Py_ssize_t slot)
+{
+    return ModDict_key_of(self->rem_keys, self->key_itemsize, slot);
+}
+
+/*
+ * remainder index: rem -> position in insertion order, -1 if empty
+ */
+inline static Py_ssize_t
+ModDict_remainder_at(ModDictObject *self, Py_ssize_t rem)
+{
+    digit index;
+
+    if (self->rem_itemsize == sizeof(uint16_t))
+        index = ((const uint16_t *) self->remainder)[rem];
+    else
+        index = ((const digit *) self->remainder)[rem];
+    return (index < self->size) ? (Py_ssize_t) index : -1;
+}
+
+/*
+ * returns the slot of keys/values holding nkey: the remainder itself,
+ * or the position the index points to in compact mode
+ */
+inline static Py_ssize_t
+ModDict_check_slot(ModDictObject *self, uint64_t nkey, Py_ssize_t rem)
+{
+    if (self->compact && (rem = ModDict_remainder_at(self, rem)) < 0)
+        return MODDICT_KEY_FAILED;
+    if (nkey != ModDict_key_at(self, rem))
+        return MODDICT_KEY_FAILED;
+    return rem;
+}
+
+inline static Py_ssize_t
+ModDict_lookup(ModDictObject *self, uint64_t nkey)
+{
+    if ((nkey >> 32) && self->key_itemsize == sizeof(digit))
+        return MODDICT_KEY_FAILED;
+    return ModDict_check_slot(self, nkey, ModDict_slot_of(&self->div, self->buckets, nkey));
+}
+
+static Py_ssize_t
+ModDict_check_remainder(ModDictObject *self, PyObject *key)
+{
+#if MODDICT_USE_LONGOBJECT
+    PyLongObject *lkey = (PyLongObject *) key;
+    uint64_t nkey;
+
+    switch (Py_SIZE(key)) {
+    case 0:
+        nkey = 0;
+        break;
+    case 1:
+        nkey = lkey->ob_digit[0];
+        break;
+    case 2:
+        nkey = lkey->ob_digit[0] | ((uint64_t) lkey->ob_digit[1] << PyLong_SHIFT);
+        break;
+    case 3:
+        /* 30-bit digits: the top one holds the last 4 bits */
+        if (PyLong_SHIFT * 3 > 64 && (lkey->ob_digit[2] >> (64 - PyLong_SHIFT * 2)))
+            return MODDICT_KEY_FAILED;
+        nkey = (lkey->ob_digit[0] | ((uint64_t) lkey->ob_digit[1] << PyLong_SHIFT) |
+                ((uint64_t) lkey->ob_digit[2] << (PyLong_SHIFT * 2)));
+        break;
+    default:
+        return MODDICT_KEY_FAILED;
+    }
+    return ModDict_lookup(self, nkey);
+#else
+    unsigned long long ukey;
+
+#if PY_VERSION_HEX >= 0x030C0000
+    /* a compact int (one digit) holds its value inline */
+    if (PyUnstable_Long_IsCompact((PyLongObject *) key)) {
+        Py_ssize_t value = PyUnstable_Long_CompactValue((PyLongObject *) key);
+
+        return (value < 0) ? MODDICT_KEY_FAILED : ModDict_lookup(self, (uint64_t) value);
+    }
+#endif
+    ukey = PyLong_AsUnsignedLongLong(key);
+    if (ukey == (unsigned long long) -1 && PyErr_Occurred()) {
+        PyErr_Clear();
+        return MODDICT_KEY_FAILED;
+    }
+    return ModDict_lookup(self, ukey);
+#endif
+}
+
+/*
+ * hashed: the slot of the hash, if it holds the key itself
+ */
+static Py_ssize_t
+ModDict_check_hashed(ModDictObject *self, PyObject *key)
+{
+    Py_ssize_t slot;
+    uint64_t nkey;
+
+    if (!ModDict_hash_key(key, self->seed, self->key_itemsize, &nkey))
+        return MODDICT_KEY_FAILED;
+    if ((slot = ModDict_lookup(self, nkey)) < 0)
+        return slot;
+    if (!ModDict_same_key(PyTuple_GET_ITEM(self->keys, slot), key))
+        return MODDICT_KEY_FAILED;
+    return slot;
+}
+
+inline static Py_ssize_t
+ModDict_check_key(ModDictObject *self, PyObject *key)
+{
+    if (self->hashed && self->divisor)
+        return ModDict_check_hashed(self, key);
+    if (!PyLong_CheckExact(key))
+        return MODDICT_KEY_ERROR;
+    if (!self->divisor)
+        return MODDICT_KEY_ERROR;
+    return ModDict_check_remainder(self, key);
+}
+
+inline static long long
+ModDict_slot_number(ModDictObject *self, Py_ssize_t slot)
+{
+    if (self->value_itemsize == sizeof(int32_t))
+        return ((const int32_t *) self->numbers)[slot];
+    return ((const int64_t *) self->numbers)[slot];
+}
+
+inline static PyObject *
+ModDict_get_remainder_value(ModDictObject *self, Py_ssize_t rem)
+{
+    if (self->value_itemsize)
+        return PyLong_FromLongLong(ModDict_slot_number(self, rem));
+    return IncRef(PyTuple_GET_ITEM(self->values, rem));
+}
+
+inline static PyObject *
+ModDict_get_remainder_key(ModDictObject *self, Py_ssize_t slot)
+{
+    if (self->hashed)
+        return IncRef(PyTuple_GET_ITEM(self->keys, slot));
+    return PyLong_FromUnsignedLongLong(ModDict_key_at(self, slot));
+}
+
+inline static PyObject *
+ModDict_get_value(ModDictObject *self, PyObject *key)
+{
+    Py_ssize_t rem = ModDict_check_key(self, key);
+    if (rem >= 0)
+        return ModDict_get_remainder_value(self, rem);
+    return SetKeyError(key);
+}
+
+/*
+ * Insertion order: the slot of the pos-th key is kept in order, or is
+ * pos itself in compact mode
+ */
+
+enum {
+    MODDICT_ITEM_KEY,
+    MODDICT_ITEM_VALUE,
+    MODDICT_ITEM_PAIR,
+};
+
+inline static Py_ssize_t
+ModDict_slot_at(ModDictObject *self, Py_ssize_t pos)
+{
+    return self->order ? (Py_ssize_t) self->order[pos] : pos;
+}
+
+static PyObject *
+ModDict_item_at(ModDictObject *self, Py_ssize_t pos, int kind)
+{
+    Py_ssize_t slot = ModDict_slot_at(self, pos);
+    PyObject *key, *value, *item;
+
+    if (kind == MODDICT_ITEM_KEY)
+        return ModDict_get_remainder_key(self, slot);
+    if (kind == MODDICT_ITEM_VALUE)
+        return ModDict_get_remainder_value(self, slot);
+    if (!(key = ModDict_get_remainder_key(self, slot)))
+        return NULL;
+    if (!(value = ModDict_get_remainder_value(self, slot)) ||
+        !(item = PyTuple_New(2))) {
+        Py_DECREF(key);
+        Py_XDECREF(value);
+        return NULL;
+    }
+    PyTuple_SET_ITEM(item, 0, key);
+    PyTuple_SET_ITEM(item, 1, value);
+    return item;
+}
+
+static PyObject *
+ModDict_create_list(ModDictObject *self, int kind)
+{
+    PyObject *list, *item;
+    Py_ssize_t pos;
+
+    if (!(list = PyList_New(self->size)))
+        return NULL;
+    for (pos = 0; pos < self->size; pos++) {
+        if (!(item = ModDict_item_at(self, pos, kind))) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, pos, item);
+    }
+    return list;
+}
+
+static PyObject *
+ModDict_to_dict(ModDictObject *self)
+{
+    PyObject *dict, *key = NULL, *value = NULL;
+    Py_ssize_t pos, slot;
+
+    if (!(dict = PyDict_New()))
+        return NULL;
+    for (pos = 0; pos < self->size; pos++) {
+        slot = ModDict_slot_at(self, pos);
+        if (!(key = ModDict_get_remainder_key(self, slot)) ||
+            !(value = ModDict_get_remainder_value(self, slot)) ||
+            PyDict_SetItem(dict, key, value) < 0)
+            goto error;
+        ClearObject(&key);
+        ClearObject(&value);
+    }
+    return dict;
+
+error:
+    Py_XDECREF(key);
+    Py_XDECREF(value);
+    Py_DECREF(dict);
+    return NULL;
+}
+
+/*
+ * Buffer: 1-D integer arrays (array('I'), numpy uint32, ...)
+ */
+
+typedef struct ModDictBuffer {
+    Py_buffer view;
+    Py_ssize_t length;
+    bool is_signed;
+} ModDictBuffer;
+
+/*
+ * returns: 1 = integer buffer, 0 = no buffer interface, -1 = error
+ */
+static int
+ModDictBuffer_get(ModDictBuffer *buffer, PyObject *obj, bool writable)
+{
+    const char *format;
+    int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT;
+
+    if (!PyObject_CheckBuffer(obj))
+        return 0;
+    if (writable)
+        flags |= PyBUF_WRITABLE;
+    if (PyObject_GetBuffer(obj, &buffer->view, flags) < 0)
+        return -1;
+
+    format = buffer->view.format ? buffer->view.format : "B";
+    if (*format == '@' || *format == '=')
+        format++;
+    if (!format[0] || format[1] || !strchr("bBhHiIlLqQnN", format[0]) ||
+        !(buffer->view.itemsize == 1 || buffer->view.itemsize == 2 ||
+          buffer->view.itemsize == 4 || buffer->view.itemsize == 8)) {
+        PyErr_Format(PyExc_TypeError, "unsupported buffer format '%s'",
+                     buffer->view.format ? buffer->view.format : "B");
+        PyBuffer_Release(&buffer->view);
+        return -1;
+    }
+    buffer->is_signed = (bool) islower(format[0]);
+    buffer->length = buffer->view.len / buffer->view.itemsize;
+    return 1;
+}
+
+static void
+ModDictBuffer_release(ModDictBuffer *buffer)
+{
+    PyBuffer_Release(&buffer->view);
+}
+
+inline static long long
+ModDictBuffer_signed(const ModDictBuffer *buffer, Py_ssize_t pos)
+{
+    const void *buf = buffer->view.buf;
+
+    switch (buffer->view.itemsize) {
+    case 1: return ((const int8_t *) buf)[pos];
+    case 2: return ((const int16_t *) buf)[pos];
+    case 4: return ((const int32_t *) buf)[pos];
+    default: return ((const int64_t *) buf)[pos];
+    }
+}
+
+inline static unsigned long long
+ModDictBuffer_unsigned(const ModDictBuffer *buffer, Py_ssize_t pos)
+{
+    const void *buf = buffer->view.buf;
+
+    switch (buffer->view.itemsize) {
+    case 1: return ((const uint8_t *) buf)[pos];
+    case 2: return ((const uint16_t *) buf)[pos];
+    case 4: return ((const uint32_t *) buf)[pos];
+    default: return ((const uint64_t *) buf)[pos];
+    }
+}
+
+/*
+ * reads a key; false if it is negative
+ */
+inline static bool
+ModDictBuffer_key(const ModDictBuffer *buffer, Py_ssize_t pos, uint64_t *nkey)
+{
+    long long skey;
+
+    if (buffer->is_signed) {
+        if ((skey = ModDictBuffer_signed(buffer, pos)) < 0)
+            return false;
+        *nkey = (uint64_t) skey;
+    }
+    else
+        *nkey = ModDictBuffer_unsigned(buffer, pos);
+    return true;
+}
+
+static int
+ModDictBuffer_store(ModDictBuffer *buffer, Py_ssize_t pos, long long value)
+{
+    void *buf = buffer->view.buf;
+    int bits = (int) buffer->view.itemsize * 8;
+
+    if (buffer->is_signed) {
+        if (bits < 64 && (value < -(1LL << (bits - 1)) || value >= (1LL << (bits - 1))))
+            goto overflow;
+    }
+    else if (value < 0 || (bits < 64 && value >= (1LL << bits)))
+        goto overflow;
+
+    switch (buffer->view.itemsize) {
+    case 1: ((uint8_t *) buf)[pos] = (uint8_t) value; break;
+    case 2: ((uint16_t *) buf)[pos] = (uint16_t) value; break;
+    case 4: ((uint32_t *) buf)[pos] = (uint32_t) value; break;
+    default: ((uint64_t *) buf)[pos] = (uint64_t) value; break;
+    }
+    return 0;
+
+overflow:
+    PyErr_Format(PyExc_OverflowError, "value %lld does not fit the output buffer", value);
+    return -1;
+}
+
+/*
+ * Construction source
+ *
+ * The keys are converted once, in insertion order, into an arena that
+ * also holds their sorted copy for the search.  Keys are digit, or
+ * uint64_t for key_bits=64; hashed keys are kept in objects and the
+ * arena holds their hashes.  Values stay where they are: a dense tuple,
+ * one value for every key, an integer buffer (from_buffers) or the key
+ * numbering.
+ */
+
+typedef struct ModDictSource {
+    void *keys;
+    void *sorted;
+    int key_itemsize;
+    Py_ssize_t size;
+    Py_ssize_t capacity;
+    PyObject *values;
+    PyObject *defval;
+    const ModDictBuffer *numbers;
+    Py_ssize_t *last;
+    PyObject *objects;
+    bool hashed;
+    bool reseed;
+    uint32_t seed;
+} ModDictSource;
+
+static void
+ModDictSource_fini(ModDictSource *src)
+{
+    PyMem_Free(src->keys);
+    PyMem_RawFree(src->last);
+    Py_XDECREF(src->values);
+    Py_XDECREF(src->objects);
+    src->keys = src->sorted = NULL;
+    src->last = NULL;
+    src->values = NULL;
+    src->objects = NULL;
+}
+
+static int
+ModDictSource_reserve(ModDictSource *src, Py_ssize_t capacity)
+{
+    void *keys;
+
+    if (capacity <= src->capacity)
+        return 0;
+    if (!(keys = PyMem_Realloc(src->keys, capacity * src->key_itemsize))) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    src->keys = keys;
+    src->capacity = capacity;
+    return 0;
+}
+
+inline static uint64_t
+ModDictSource_key(const ModDictSource *src, Py_ssize_t pos)
+{
+    return ModDict_key_of(src->keys, src->key_itemsize, pos);
+}
+
+/*
+ * false if nkey does not fit the key width
+ */
+inline static bool
+ModDictSource_put(ModDictSource *src, Py_ssize_t pos, uint64_t nkey)
+{
+    if ((nkey >> 32) && src->key_itemsize == sizeof(digit))
+        return false;
+    ModDict_set_key(src->keys, src->key_itemsize, pos, nkey);
+    return true;
+}
+
+/*
+ * false if key is not an int in 0..0xffffffffffffffff
+ */
+inline static bool
+ModDict_convert_key(PyObject *key, uint64_t *nkey)
+{
+    unsigned long long key_num;
+    long long skey;
+    int overflow;
+
+    if (!PyLong_CheckExact(key))
+        return false;
+    skey = PyLong_AsLongLongAndOverflow(key, &overflow);
+    if (!overflow) {
+        *nkey = (uint64_t) skey;
+        return skey >= 0;
+    }
+    if (overflow < 0)
+        return false;
+    key_num = PyLong_AsUnsignedLongLong(key);
+    if (key_num == (unsigned long long) -1 && PyErr_Occurred()) {
+        PyErr_Clear();
+        return false;
+    }
+    *nkey = key_num;
+    return true;
+}
+
+static int
+ModDictSource_from_dict(ModDictSource *src, PyObject *dict)
+{
+    Py_ssize_t size = PyDict_Size(dict);
+    Py_ssize_t dict_pos = 0, pos = 0;
+    PyObject *key, *val;
+    uint64_t nkey;
+
+    if (ModDictSource_reserve(src, size * 2) < 0)
+        return -1;
+    if (!(src->values = PyTuple_New(size)))
+        return -1;
+    if (src->hashed && !(src->objects = PyTuple_New(size)))
+        return -1;
+    while (PyDict_Next(dict, &dict_pos, &key, &val)) {
+        if (src->hashed)
+            PyTuple_SET_ITEM(src->objects, pos, IncRef(key));
+        else if (!ModDict_convert_key(key, &nkey) || !ModDictSource_put(src, pos, nkey)) {
+            PyErr_SetObject(PyExc_KeyError, key);
+            return -1;
+        }
+        PyTuple_SET_ITEM(src->values, pos, IncRef(val));
+        pos++;
+    }
+    src->size = pos;
+    return 0;
+}
+
+static int
+ModDictSource_from_moddict(ModDictSource *src, ModDictObject *moddict)
+{
+    Py_ssize_t size = moddict->size, pos, slot;
+    PyObject *key, *val;
+
+    if (ModDictSource_reserve(src, size * 2) < 0)
+        return -1;
+    if (!(src->values = PyTuple_New(size)))
+        return -1;
+    if (src->hashed && !(src->objects = PyTuple_New(size)))
+        return -1;
+    for (pos = 0; pos < size; pos++) {
+        slot = ModDict_slot_at(moddict, pos);
+        if (src->hashed) {
+            if (!(key = ModDict_get_remainder_key(moddict, slot)))
+                return -1;
+            PyTuple_SET_ITEM(src->objects, pos, key);
+        }
+        else if (moddict->hashed || !ModDictSource_put(src, pos, ModDict_key_at(moddict, slot))) {
+            if ((key = ModDict_get_remainder_key(moddict, slot))) {
+                PyErr_SetObject(PyExc_KeyError, key);
+                Py_DECREF(key);
+            }
+            return -1;
+        }
+        if (!(val = ModDict_item_at(moddict, pos, MODDICT_ITEM_VALUE)))
+            return -1;
+        PyTuple_SET_ITEM(src->values, pos, val);
+    }
+    src->size = size;
+    return 0;
+}
+
+static int
+ModDictSource_from_buffer(ModDictSource *src, const ModDictBuffer *buffer)
+{
+    Py_ssize_t pos;
+    PyObject *key;
+    uint64_t nkey;
+
+    if (ModDictSource_reserve(src, Py_MAX(buffer->length, 1) * 2) < 0)
+        return -1;
+    Py_BEGIN_ALLOW_THREADS
+    for (pos = 0; pos < buffer->length; pos++) {
+        if (!ModDictBuffer_key(buffer, pos, &nkey) || !ModDictSource_put(src, pos, nkey))
+            break;
+    }
+    Py_END_ALLOW_THREADS
+    if (pos < buffer->length) {
+        if (buffer->is_signed)
+            key = PyLong_FromLongLong(ModDictBuffer_signed(buffer, pos));
+        else
+            key = PyLong_FromUnsignedLongLong(ModDictBuffer_unsigned(buffer, pos));
+        if (key) {
+            PyErr_SetObject(PyExc_KeyError, key);
+            Py_DECREF(key);
+        }
+        return -1;
+    }
+    src->size = buffer->length;
+    return 0;
+}
+
+static int
+ModDictSource_from_iterable(ModDictSource *src, PyObject *iterable)
+{
+    PyObject *it, *key;
+    Py_ssize_t pos, hint;
+    uint64_t nkey;
+
+    if ((hint = PyObject_LengthHint(iterable, 64)) < 0)
+        return -1;
+    if (ModDictSource_reserve(src, Py_MAX(hint, 1)) < 0)
+        return -1;
+    if (!(it = PyObject_GetIter(iterable)))
+        return -1;
+    for (pos = 0; (key = PyIter_Next(it)); pos++) {
+        if (pos == src->capacity && ModDictSource_reserve(src, pos * 2) < 0)
+            goto error;
+        if (!ModDict_convert_key(key, &nkey) || !ModDictSource_put(src, pos, nkey)) {
+            PyErr_SetObject(PyExc_KeyError, key);
+            goto error;
+        }
+        Py_DECREF(key);
+    }
+    Py_DECREF(it);
+    if (PyErr_Occurred())
+        return -1;
+    src->size = pos;
+    return ModDictSource_reserve(src, pos * 2);
+
+error:
+    Py_DECREF(key);
+    Py_DECREF(it);
+    return -1;
+}
+
+/*
+ * hashed keys from an iterable: numbered (or given value) through a dict,
+ * so that the keys are distinct
+ */
+static int
+ModDictSource_from_keys(ModDictSource *src, PyObject *iterable)
+{
+    PyObject *dict, *it, *key, *val;
+    Py_ssize_t pos;
+    int res = -1;
+
+    if (!(dict = PyDict_New()))
+        return -1;
+    if (!(it = PyObject_GetIter(iterable)))
+        goto done;
+    for (pos = 0; (key = PyIter_Next(it)); pos++) {
+        val = src->defval ? IncRef(src->defval) : PyLong_FromSsize_t(pos);
+        if (!val || PyDict_SetItem(dict, key, val) < 0) {
+            Py_XDECREF(val);
+            Py_DECREF(key);
+            goto done;
+        }
+        Py_DECREF(val);
+        Py_DECREF(key);
+    }
+    if (!PyErr_Occurred())
+        res = ModDictSource_from_dict(src, dict);
+done:
+    Py_XDECREF(it);
+    Py_DECREF(dict);
+    return res;
+}
+
+/*
+ * hashes the objects of a hashed source under src->seed
+ */
+static int
+ModDictSource_hash(ModDictSource *src)
+{
+    PyObject *key;
+    Py_ssize_t pos;
+    uint64_t nkey;
+
+    for (pos = 0; pos < src->size; pos++) {
+        key = PyTuple_GET_ITEM(src->objects, pos);
+        if (!ModDict_hash_key(key, src->seed, src->key_itemsize, &nkey)) {
+            PyErr_SetObject(PyExc_KeyError, key);
+            return -1;
+        }
+        ModDict_set_key(src->keys, src->key_itemsize, pos, nkey);
+    }
+    return 0;
+}
+
+/*
+ * Sorts a copy of the keys for the search; true if a key repeats.
+ * Runs without the GIL.
+ */
+static bool
+ModDictSource_sort_copy(ModDictSource *src)
+{
+    Py_ssize_t size = src->size, pos;
+    int itemsize = src->key_itemsize;
+    void *sorted = (char *) src->keys + size * itemsize;
+
+    memcpy(sorted, src->keys, size * itemsize);
+    qsort(sorted, size, itemsize,
+          (itemsize == sizeof(uint64_t)) ? ModDict_compare_key64 : ModDict_compare_key);
+    src->sorted = sorted;
+    for (pos = 1; pos < size; pos++) {
+        if (ModDict_key_of(sorted, itemsize, pos) == ModDict_key_of(sorted, itemsize, pos - 1))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Repeated keys (only an iterable or a buffer has them) keep their first
+ * position; a numbered key gets the index of its last occurrence, and a
+ * key with a buffer of values its last value, like a dict built from
+ * them.
+ *
+ * returns: 0, -1 = no memory
+ * Runs without the GIL.
+ */
+static int
+ModDictSource_dedupe(ModDictSource *src)
+{
+    Py_ssize_t size = src->size;
+    int itemsize = src->key_itemsize;
+    void *keys = src->keys, *sorted = src->sorted;
+    Py_ssize_t *table = NULL;
+    Py_ssize_t pos, count, slot;
+    uint64_t mask, key;
+    int bits;
+
+    for (count = 0, pos = 0; pos < size; pos++) {
+        key = ModDict_key_of(sorted, itemsize, pos);
+        if (!pos || key != ModDict_key_of(sorted, itemsize, pos - 1))
+            ModDict_set_key(sorted, itemsize, count++, key);
+    }
+    /* open addressing over the first positions, keyed by the key */
+    for (bits = 1; ((Py_ssize_t) 1 << bits) < count * 2; bits++)
+        ;
+    mask = ((uint64_t) 1 << bits) - 1;
+    if (!(table = PyMem_RawCalloc((size_t) 1 << bits, sizeof(Py_ssize_t))))
+        return -1;
+    if (!src->values && !src->defval &&
+        !(src->last = PyMem_RawMalloc(count * sizeof(Py_ssize_t)))) {
+        PyMem_RawFree(table);
+        return -1;
+    }
+    for (count = 0, pos = 0; pos < size; pos++) {
+        key = ModDict_key_of(keys, itemsize, pos);
+        slot = (Py_ssize_t) ((key * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+        while (table[slot] && ModDict_key_of(keys, itemsize, table[slot] - 1) != key)
+            slot = (slot + 1) & mask;
+        if (!table[slot]) {
+            ModDict_set_key(keys, itemsize, count, key);
+            table[slot] = ++count;
+        }
+        if (src->last)
+            src->last[table[slot] - 1] = pos;
+    }
+    src->size = count;
+    PyMem_RawFree(table);
+    return 0;
+}
+
+/*
+ * The keys of a hashed source are distinct, so a repeated hash is a
+ * collision and the keys are hashed again under the next seed.
+ */
+static int
+ModDictSource_sort(ModDictSource *src)
+{
+    int res = 0;
+
+    if (!src->hashed) {
+        Py_BEGIN_ALLOW_THREADS
+        if (ModDictSource_sort_copy(src))
+            res = ModDictSource_dedupe(src);
+        Py_END_ALLOW_THREADS
+        if (res < 0)
+            PyErr_NoMemory();
+        return res;
+    }
+    if (ModDictSource_hash(src) < 0)
+        return -1;
+    while (ModDictSource_sort_copy(src)) {
+        if (!src->reseed || src->seed + 1 >= MODDICT_HASH_SEEDS) {
+            PyErr_Format(PyExc_ValueError, "keys collide under hash seed %lu",
+                         (unsigned long) src->seed);
+            return -1;
+        }
+        src->seed++;
+        if (ModDictSource_hash(src) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+ModDictSource_value(const ModDictSource *src, Py_ssize_t pos)
+{
+    if (src->values)
+        return IncRef(PyTuple_GET_ITEM(src->values, pos));
+    if (src->defval)
+        return IncRef(src->defval);
+    pos = src->last ? src->last[pos] : pos;
+    if (src->numbers && src->numbers->is_signed)
+        return PyLong_FromLongLong(ModDictBuffer_signed(src->numbers, pos));
+    if (src->numbers)
+        return PyLong_FromUnsignedLongLong(ModDictBuffer_unsigned(src->numbers, pos));
+    return PyLong_FromSsize_t(pos);
+}
+
+/*
+ * typed values: false (with TypeError) if not an int within 64 bits
+ */
+static bool
+ModDictSource_number(const ModDictSource *src, Py_ssize_t pos, long long *number)
+{
+    PyObject *value;
+    int overflow;
+
+    if (!src->values && !src->defval) {
+        pos = src->last ? src->last[pos] : pos;
+        if (!src->numbers)
+            *number = pos;
+        else if (src->numbers->is_signed)
+            *number = ModDictBuffer_signed(src->numbers, pos);
+        else if ((*number = (long long) ModDictBuffer_unsigned(src->numbers, pos)) < 0)
+            goto overflow;
+        return true;
+    }
+    value = src->values ? PyTuple_GET_ITEM(src->values, pos) : src->defval;
+    if (PyLong_CheckExact(value)) {
+        *number = PyLong_AsLongLongAndOverflow(value, &overflow);
+        if (!overflow)
+            return true;
+    }
+overflow:
+    PyErr_SetString(PyExc_TypeError, "typed values must be int within 64 bits");
+    return false;
+}
+
+/*
+ * Builds the tables in one pass over the keys in insertion order: the
+ * remainder index, rem_keys and the values (or numbers) are indexed by
+ * slot, or by position in compact mode.
+ */
+static int
+ModDict_create_table(ModDictObject *self, ModDictSource *src, const ModDictParam *param)
+{
+    PyObject *divisor_ = NULL;
+    PyObject *values = NULL;
+    PyObject *keys = NULL;
+    PyObject *val;
+
+    digit divisor, divmax, digmax;
+    digit table_size = 0;
+    ModDictDivider div;
+    ModDictBucket *buckets = NULL;
+    void *remainder = NULL;
+    void *rem_keys = NULL;
+    digit *order = NULL;
+    void *numbers = NULL;
+    int rem_itemsize = sizeof(digit);
+    int value_itemsize = 0;
+    int key_itemsize = src->key_itemsize;
+
+    Py_ssize_t size, slots, pos, slot, rem;
+    uint64_t nkey, keymax, candidate, tablemax;
+    long long number;
+    int64_t fdivisor;
+    ModDictBudget budget;
+    bool bounded;
+
+    digmax = 0xffffffff;
+
+    ModDict_clear(self);
+    self->hashed = src->hashed;
+
+    if (!src->size)
+        return 0;
+    if (src->size > digmax)
+        goto type_error;
+    if (ModDictSource_sort(src) < 0)
+        return -1;
+    size = src->size;
+    /* the divisor above the largest key is always injective, as is any candidate above it */
+    keymax = ModDict_key_of(src->sorted, key_itemsize, size - 1);
+    divmax = Py_MAX((digit) size, (keymax < digmax) ? (digit) keymax + 1 : digmax);
+    candidate = ModDict_next_candidate(divmax, param->prefer);
+    divmax = (digit) Py_MIN(candidate, (uint64_t) digmax);
+    if (param->max_load > 0 && size * param->max_load < divmax)
+        divmax = (digit) (size * param->max_load);
+    budget.prefer = param->prefer;
+    budget.deadline = (param->timeout > 0) ? ModDict_now() + param->timeout : 0;
+    bounded = (param->max_load > 0 || param->timeout > 0 ||
+               param->prefer != MODDICT_PREFER_ANY);
+
+    ModDictDivider_init(&div, 0);
+    /* the mask above the largest key is always injective, over 2 slots at least */
+    tablemax = Py_MAX((uint64_t) size, Py_MIN(keymax, digmax) + 1);
+    tablemax = ModDict_next_candidate(Py_MAX(tablemax, 2), MODDICT_PREFER_POW2);
+    if (param->max_load > 0 && size * param->max_load < tablemax)
+        tablemax = (uint64_t) (size * param->max_load);
+    if (param->divisor && param->multiplier)
+        tablemax = param->divisor;
+    /* a search resumed past the largest table starts over */
+    budget.start = param->divmin;
+    if (budget.start > ((param->engine == MODDICT_ENGINE_MUL) ? tablemax : divmax))
+        budget.start = 0;
+
+    Py_BEGIN_ALLOW_THREADS
+    if (param->engine == MODDICT_ENGINE_MUL)
+        fdivisor = ModDict_find_multiplier(tablemax, size, src->sorted, key_itemsize,
+                                           param->multiplier, &budget, &div);
+    else if (param->divisor)
+        fdivisor = ModDict_verify_divisor(param->divisor, param->levels, size, src->sorted,
+                                          key_itemsize, &buckets, &table_size);
+    else if (param->levels == 2)
+        fdivisor = ModDict_find_two_level(size, src->sorted, param->max_load, &budget,
+                                          &buckets, &table_size);
+    else {
+        fdivisor = ModDict_find_divisor(divmax, size, src->sorted, key_itemsize, param->threads,
+                                        &budget);
+        /* no divisor within the budget: buckets keep the table small, by the same deadline */
+        if (fdivisor == 0 && bounded && key_itemsize == sizeof(digit))
+            fdivisor = ModDict_find_two_level(size, src->sorted, param->max_load, &budget,
+                                              &buckets, &table_size);
+    }
+    Py_END_ALLOW_THREADS
+    if (fdivisor < 0) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    if (fdivisor == 0 && bounded && !param->divisor) {
+        PyErr_SetString(PyExc_ValueError, "no table within max_load, timeout and prefer");
+        goto error;
+    }
+    if (fdivisor == 0 && param->multiplier) {
+        PyErr_Format(PyExc_ValueError, "multiplier %llu is not injective over the keys",
+                     (unsigned long long) param->multiplier);
+        goto error;
+    }
+    if (fdivisor == 0 && param->divisor) {
+        PyErr_Format(PyExc_ValueError, "divisor %lu is not injective over the keys",
+                     (unsigned long) param->divisor);
+        goto error;
+    }
+    if (fdivisor == 0 && param->engine == MODDICT_ENGINE_MUL) {
+        PyErr_SetString(PyExc_ValueError, "no multiplier within 2**31 slots");
+        goto error;
+    }
+    if (fdivisor == 0)
+        goto type_error;
+    divisor = (digit) fdivisor;
+    if (!div.multiplier)
+        ModDictDivider_init(&div, divisor);
+    if (!buckets)
+        table_size = divisor;
+    if (!(divisor_ = PyLong_FromUnsignedLong(divisor)))
+        goto error;
+
+    /*
+     * In compact mode only the remainder index is sparse; keys and
+     * values stay dense in insertion order and the index points into them.
+     */
+    slots = param->compact ? size : (Py_ssize_t) table_size;
+    if (param->compact && size < 0xffff)
+        rem_itemsize = sizeof(uint16_t);
+    if (param->typed > 0) {
+        value_itemsize = sizeof(int32_t);
+        for (pos = 0; pos < size; pos++) {
+            if (!ModDictSource_number(src, pos, &number))
+                goto error;
+            if (number < INT32_MIN || number > INT32_MAX) {
+                value_itemsize = sizeof(int64_t);
+                break;
+            }
+        }
+        if (!(numbers = PyMem_Calloc(slots, value_itemsize)))
+            goto nomemory;
+    }
+    else if (param->compact && src->values)
+        values = IncRef(src->values);
+    else if (!(values = PyTuple_New(slots)))
+        goto error;
+    if (src->hashed && param->compact)
+        keys = IncRef(src->objects);
+    else if (src->hashed && !(keys = PyTuple_New(slots)))
+        goto error;
+
+    if (!(remainder = PyMem_Malloc(table_size * rem_itemsize)))
+        goto nomemory;
+    memset(remainder, 0xff, table_size * rem_itemsize);
+    if (!param->compact) {
+        if (!(rem_keys = PyMem_Malloc(slots * key_itemsize)))
+            goto nomemory;
+        if (!(order = PyMem_Malloc(size * sizeof(digit))))
+            goto nomemory;
+        /*
+         * an empty slot holds a key of the dict: it always leads to its
+         * own slot, so no lookup can match an empty one
+         */
+        for (slot = 0; slot < slots; slot++)
+            ModDict_set_key(rem_keys, key_itemsize, slot, ModDictSource_key(src, 0));
+    }
+
+    for (pos = 0; pos < size; pos++) {
+        nkey = ModDictSource_key(src, pos);
+        rem = ModDict_slot_of(&div, buckets, nkey);
+        if (rem_itemsize == sizeof(uint16_t))
+            ((uint16_t *) remainder)[rem] = (uint16_t) pos;
+        else
+            ((digit *) remainder)[rem] = (digit) pos;
+        slot = param->compact ? pos : rem;
+        if (order) {
+            order[pos] = (digit) rem;
+            ModDict_set_key(rem_keys, key_itemsize, slot, nkey);
+        }
+        if (numbers) {
+            if (!ModDictSource_number(src, pos, &number))
+                goto error;
+            if (value_itemsize == sizeof(int32_t))
+                ((int32_t *) numbers)[slot] = (int32_t) number;
+            else
+                ((int64_t *) numbers)[slot] = number;
+        }
+        else if (values != src->values) {
+            if (!(val = ModDictSource_value(src, pos)))
+                goto error;
+            PyTuple_SET_ITEM(values, slot, val);
+        }
+        if (keys && keys != src->objects)
+            PyTuple_SET_ITEM(keys, slot, IncRef(PyTuple_GET_ITEM(src->objects, pos)));
+    }
+    if (param->compact) {
+        /* the dense keys are the arena itself, without the sorted copy */
+        rem_keys = PyMem_Realloc(src->keys, size * key_itemsize);
+        if (!rem_keys)
+            goto nomemory;
+        src->keys = src->sorted = NULL;
+        src->capacity = 0;
+    }
+
+    self->divisor = divisor;
+    self->div = div;
+    self->buckets = buckets;
+    self->table_size = table_size;
+    Py_SETREF(self->divisor_, divisor_);
+    if (values)
+        Py_SETREF(self->values, values);
+    if (keys)
+        Py_SETREF(self->keys, keys);
+    self->seed = src->seed;
+    self->numbers = numbers;
+    self->value_itemsize = value_itemsize;
+    self->remainder = remainder;
+    self->rem_keys = rem_keys;
+    self->key_itemsize = key_itemsize;
+    self->order = order;
+    self->size = size;
+    self->rem_itemsize = rem_itemsize;
+    self->compact = param->compact;
+    return 0;
+
+nomemory:
+    PyErr_NoMemory();
+    goto error;
+type_error:
+    PyErr_BadArgument();
+error:
+    Py_XDECREF(divisor_);
+    Py_XDECREF(values);
+    Py_XDECREF(keys);
+    PyMem_RawFree(buckets);
+    PyMem_Free(remainder);
+    if (!param->compact)
+        PyMem_Free(rem_keys);
+    PyMem_Free(order);
+    PyMem_Free(numbers);
+    return -1;
+}
+
+static PyObject *
+ModDict_from_dict(PyTypeObject *type, PyObject *dict, PyObject *kwargs)
+{
+    PyObject *newobj = NULL;
+    PyObject *args = NULL;
+
+    if (!dict)
+        return NULL;
+    if (!(args = PyTuple_New(1)))
+        goto error;
+    if (kwargs)
+        Py_INCREF(kwargs);
+    else if (!(kwargs = PyDict_New()))
+        goto error;
+    PyTuple_SET_ITEM(args, 0, IncRef(dict));
+    if (!(newobj = (type->tp_new)(type, args, kwargs)))
+        goto error;
+    if ((Py_TYPE(newobj)->tp_init)((PyObject *) newobj, args, kwargs) != 0)
+        goto error;
+    Py_XDECREF(args);
+    Py_XDECREF(kwargs);
+    return newobj;
+
+error:
+    Py_XDECREF(args);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(newobj);
+    return NULL;
+}
+
+/*
+ * Save file
+ *
+ * A fixed header followed by the tables exactly as they are laid out in
+ * memory, each section aligned so that load() can map the file and use
+ * them in place.  Object values are pickled as a list in insertion order.
+ * Version 2 appends the multiplier to the header; version 1 files still
+ * load.
+ */
+
+#define MODDICT_FILE_MAGIC      "MODDICT"
+#define MODDICT_FILE_VERSION    2
+#define MODDICT_FILE_BYTEORDER  0x01020304
+#define MODDICT_FILE_ALIGN      64
+
+enum {
+    MODDICT_FILE_COMPACT = 0x01,
+    MODDICT_FILE_BUCKETS = 0x02,
+    MODDICT_FILE_KEY64 = 0x04,
+    MODDICT_FILE_HASHED = 0x08,
+    MODDICT_FILE_MULTIPLY = 0x10,
+};
+
+enum {
+    MODDICT_SECTION_REMAINDER,
+    MODDICT_SECTION_REM_KEYS,
+    MODDICT_SECTION_BUCKETS,
+    MODDICT_SECTION_NUMBERS,
+    MODDICT_SECTION_VALUES,
+    MODDICT_SECTIONS,
+};
+
+typedef struct ModDictFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint32_t flags;
+    uint32_t divisor;
+    uint32_t table_size;
+    uint32_t rem_itemsize;
+    uint32_t value_itemsize;
+    uint32_t bucket_itemsize;
+    uint64_t size;
+    uint64_t offset[MODDICT_SECTIONS];
+    uint64_t length[MODDICT_SECTIONS];
+    uint64_t multiplier;
+} ModDictFileHeader;
+
+inline static size_t
+ModDictFile_header_size(const ModDictFileHeader *header)
+{
+    if (header->version == 1)
+        return offsetof(ModDictFileHeader, multiplier);
+    return sizeof(*header);
+}
+
+/*
+ * lengths of the table sections; the pickled values are left alone
+ */
+static void
+ModDictFile_lengths(const ModDictFileHeader *header, uint64_t *length)
+{
+    uint64_t slots = header->table_size;
+
+    if (header->flags & MODDICT_FILE_COMPACT)
+        slots = header->size;
+    length[MODDICT_SECTION_REMAINDER] = (uint64_t) header->table_size * header->rem_itemsize;
+    length[MODDICT_SECTION_REM_KEYS] = slots * ((header->flags & MODDICT_FILE_KEY64) ?
+                                                sizeof(uint64_t) : sizeof(digit));
+    length[MODDICT_SECTION_BUCKETS] = 0;
+    if (header->flags & MODDICT_FILE_BUCKETS)
+        length[MODDICT_SECTION_BUCKETS] = (uint64_t) header->divisor * header->bucket_itemsize;
+    length[MODDICT_SECTION_NUMBERS] = slots * header->value_itemsize;
+}
+
+/*
+ * returns the reason the header is unusable, NULL if it is fine
+ */
+static const char *
+ModDictFile_check(const ModDictFileHeader *header, size_t file_size)
+{
+    uint64_t length[MODDICT_SECTIONS];
+    bool has_values;
+    int pos;
+
+    if (file_size < offsetof(ModDictFileHeader, multiplier) ||
+        memcmp(header->magic, MODDICT_FILE_MAGIC, sizeof(MODDICT_FILE_MAGIC)))
+        return "not a ModDict file";
+    if (header->version != 1 && header->version != MODDICT_FILE_VERSION)
+        return "unsupported ModDict file version";
+    if (file_size < ModDictFile_header_size(header))
+        return "corrupt ModDict file";
+    if (header->byteorder != MODDICT_FILE_BYTEORDER)
+        return "ModDict file of another byte order";
+    if ((header->flags & MODDICT_FILE_BUCKETS) &&
+        header->bucket_itemsize != sizeof(ModDictBucket))
+        return "ModDict file of another bucket layout";
+
+    if (header->flags & ~(MODDICT_FILE_COMPACT | MODDICT_FILE_BUCKETS | MODDICT_FILE_KEY64 |
+                          MODDICT_FILE_HASHED | MODDICT_FILE_MULTIPLY))
+        goto corrupt;
+    if ((header->flags & MODDICT_FILE_MULTIPLY) &&
+        (header->version == 1 || (header->flags & MODDICT_FILE_BUCKETS) || !header->multiplier ||
+         header->divisor < 2 || (header->divisor & (header->divisor - 1)) ||
+         header->divisor > ((digit) 1 << MODDICT_MULTIPLY_MAXBITS) ||
+         (!(header->flags & MODDICT_FILE_KEY64) && header->multiplier > 0xffffffff)))
+        goto corrupt;
+    if ((header->flags & MODDICT_FILE_BUCKETS) && (header->flags & MODDICT_FILE_KEY64))
+        goto corrupt;
+    if (header->size > header->table_size)
+        goto corrupt;
+    if (!header->size ? (header->divisor || header->table_size) : !header->divisor)
+        goto corrupt;
+    if (!(header->flags & MODDICT_FILE_BUCKETS) && header->divisor != header->table_size)
+        goto corrupt;
+    if (header->rem_itemsize != sizeof(digit) &&
+        !(header->rem_itemsize == sizeof(uint16_t) && header->size < 0xffff &&
+          (header->flags & MODDICT_FILE_COMPACT)))
+        goto corrupt;
+    if (header->value_itemsize != 0 && header->value_itemsize != sizeof(int32_t) &&
+        header->value_itemsize != sizeof(int64_t))
+        goto corrupt;
+
+    ModDictFile_lengths(header, length);
+    has_values = (header->size &&
+                  (!header->value_itemsize || (header->flags & MODDICT_FILE_HASHED)));
+    length[MODDICT_SECTION_VALUES] = has_values ? header->length[MODDICT_SECTION_VALUES] : 0;
+    if (has_values && !length[MODDICT_SECTION_VALUES])
+        goto corrupt;
+    for (pos = 0; pos < MODDICT_SECTIONS; pos++) {
+        if (header->length[pos] != length[pos])
+            goto corrupt;
+        if (!length[pos])
+            continue;
+        if (header->offset[pos] % sizeof(uint64_t) ||
+            header->offset[pos] < ModDictFile_header_size(header))
+            goto corrupt;
+        if (length[pos] > file_size || header->offset[pos] > file_size - length[pos])
+            goto corrupt;
+    }
+    return NULL;
+
+corrupt:
+    return "corrupt ModDict file";
+}
+
+/*
+ * Runs without the GIL; errno tells why it failed.
+ */
+static bool
+ModDictFile_write(const char *path, const ModDictFileHeader *header,
+                  const void *const *sections)
+{
+    static const char padding[MODDICT_FILE_ALIGN];
+    uint64_t offset = sizeof(*header);
+    size_t count;
+    FILE *fp;
+    bool ok;
+    int pos;
+
+    if (!(fp = fopen(path, "wb")))
+        return false;
+    ok = (fwrite(header, sizeof(*header), 1, fp) == 1);
+    for (pos = 0; ok && pos < MODDICT_SECTIONS; pos++) {
+        if (!header->length[pos])
+            continue;
+        count = header->offset[pos] - offset;
+        ok = (fwrite(padding, 1, count, fp) == count &&
+              fwrite(sections[pos], 1, header->length[pos], fp) == header->length[pos]);
+        offset = header->offset[pos] + header->length[pos];
+    }
+    if (fclose(fp) != 0)
+        ok = false;
+    return ok;
+}
+
+/*
+ * maps the whole file read-only, or reads it into a PyMem_Raw buffer;
+ * a file too short for a header is left for ModDictFile_check to reject.
+ * Runs without the GIL; errno tells why it failed.
+ */
+static bool
+ModDictFile_open(const char *path, bool mapped, void **rbase, size_t *rsize)
+{
+    struct stat st;
+    void *base = NULL;
+    size_t size, done;
+    ssize_t count;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return false;
+    if (fstat(fd, &st) < 0)
+        goto error;
+    size = (size_t) st.st_size;
+    /* the version 1 header is the shortest */
+    if (size < offsetof(ModDictFileHeader, multiplier))
+        goto done;
+    if (mapped) {
+        if ((base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            base = NULL;
+            goto error;
+        }
+        goto done;
+    }
+    if (!(base = PyMem_RawMalloc(size))) {
+        errno = ENOMEM;
+        goto error;
+    }
+    for (done = 0; done < size; done += count) {
+        if ((count = read(fd, (char *) base + done, size - done)) < 0) {
+            if (errno == EINTR) {
+                count = 0;
+                continue;
+            }
+            goto error;
+        }
+        if (!count) {
+            errno = EIO;
+            goto error;
+        }
+    }
+done:
+    close(fd);
+    *rbase = base;
+    *rsize = size;
+    return true;
+
+error:
+    PyMem_RawFree(base);
+    close(fd);
+    return false;
+}
+
+/* ******** */
+
+static int
+ModDictParam_check(ModDictParam *param)
+{
+    long ncpu;
+
+    if (param->threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "threads must be >= 0");
+        return -1;
+    }
+    if (param->levels != 1 && param->levels != 2) {
+        PyErr_SetString(PyExc_ValueError, "levels must be 1 or 2");
+        return -1;
+    }
+    if (param->key_bits != 32 && param->key_bits != 64) {
+        PyErr_SetString(PyExc_ValueError, "key_bits must be 32 or 64");
+        return -1;
+    }
+    if (param->key_bits == 64 && param->levels == 2) {
+        PyErr_SetString(PyExc_ValueError, "levels=2 needs key_bits=32");
+        return -1;
+    }
+    if (param->engine == MODDICT_ENGINE_MUL && param->levels == 2) {
+        PyErr_SetString(PyExc_ValueError, "engine='mul' needs levels=1");
+        return -1;
+    }
+    if (param->engine == MODDICT_ENGINE_MUL && param->divisor && !param->multiplier) {
+        PyErr_SetString(PyExc_ValueError, "engine='mul' takes a divisor only with multiplier");
+        return -1;
+    }
+    if (param->multiplier && (param->divisor < 2 || (param->divisor & (param->divisor - 1)) ||
+                              param->divisor > ((digit) 1 << MODDICT_MULTIPLY_MAXBITS))) {
+        PyErr_SetString(PyExc_ValueError, "multiplier needs a power of two divisor in 2..2**31");
+        return -1;
+    }
+    if (param->multiplier > 0xffffffff && param->key_bits == 32) {
+        PyErr_SetString(PyExc_ValueError, "multiplier must be in 1..0xffffffff for key_bits=32");
+        return -1;
+    }
+    if (param->seed >= 0 && !param->hashed) {
+        PyErr_SetString(PyExc_ValueError, "seed needs hashed=True");
+        return -1;
+    }
+    if (param->threads == 0) {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        param->threads = (ncpu > 0) ? (int) ncpu : 1;
+    }
+    return 0;
+}
+
+/*
+ * the arguments of ModDict(): iterable and value are borrowed
+ */
+static int
+ModDict_parse_args(PyObject *args, PyObject *kwargs, PyObject **riterable, PyObject **rvalue,
+                   ModDictParam *param)
+{
+    static char *kwlist[] = {
+        "iterable", "value", "threads", "compact", "levels", "typed", "divisor",
+        "key_bits", "hashed", "seed", "max_load", "timeout", "prefer", "engine", "multiplier",
+        NULL,
+    };
+
+    PyObject *iterable = NULL;
+    PyObject *value = NULL;
+    PyObject *typed = Py_None;
+    PyObject *divisor = Py_None;
+    PyObject *hashed = Py_None;
+    PyObject *seed = Py_None;
+    PyObject *max_load = Py_None;
+    PyObject *timeout = Py_None;
+    PyObject *multiplier = Py_None;
+    const char *prefer = NULL;
+    const char *engine = NULL;
+    int key_bits = 0;
+    unsigned long ldivisor, lseed;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O$ipiOOiOOOOzzO",
+                                     kwlist, &iterable, &value,
+                                     &param->threads, &param->compact,
+                                     &param->levels, &typed, &divisor, &key_bits,
+                                     &hashed, &seed, &max_load, &timeout, &prefer,
+                                     &engine, &multiplier))
+        return -1;
+    if (prefer && !strcmp(prefer, "pow2"))
+        param->prefer = MODDICT_PREFER_POW2;
+    else if (prefer && !strcmp(prefer, "prime"))
+        param->prefer = MODDICT_PREFER_PRIME;
+    else if (prefer) {
+        PyErr_SetString(PyExc_ValueError, "prefer must be None, 'pow2' or 'prime'");
+        return -1;
+    }
+    if (engine && !strcmp(engine, "mul"))
+        param->engine = MODDICT_ENGINE_MUL;
+    else if (engine && strcmp(engine, "mod")) {
+        PyErr_SetString(PyExc_ValueError, "engine must be 'mod' or 'mul'");
+        return -1;
+    }
+    /* a known multiplier, with the table size as divisor, is only verified */
+    if (multiplier != Py_None) {
+        param->multiplier = PyLong_AsUnsignedLongLong(multiplier);
+        if (param->multiplier == (unsigned long long) -1 && PyErr_Occurred())
+            return -1;
+        if (!param->multiplier) {
+            PyErr_SetString(PyExc_ValueError, "multiplier must not be 0");
+            return -1;
+        }
+        param->engine = MODDICT_ENGINE_MUL;
+    }
+    /* table slots per key, and seconds for the divisor search */
+    if (max_load != Py_None) {
+        if ((param->max_load = PyFloat_AsDouble(max_load)) == -1 && PyErr_Occurred())
+            return -1;
+        if (!(param->max_load >= 1)) {
+            PyErr_SetString(PyExc_ValueError, "max_load must be >= 1");
+            return -1;
+        }
+    }
+    if (timeout != Py_None) {
+        if ((param->timeout = PyFloat_AsDouble(timeout)) == -1 && PyErr_Occurred())
+            return -1;
+        if (!(param->timeout > 0)) {
+            PyErr_SetString(PyExc_ValueError, "timeout must be > 0");
+            return -1;
+        }
+    }
+    /* a known divisor is only verified */
+    if (divisor != Py_None) {
+        ldivisor = PyLong_AsUnsignedLong(divisor);
+        if (ldivisor == (unsigned long) -1 && PyErr_Occurred())
+            return -1;
+        if (!ldivisor || ldivisor > 0xffffffff) {
+            PyErr_SetString(PyExc_ValueError, "divisor must be in 1..0xffffffff");
+            return -1;
+        }
+        param->divisor = (digit) ldivisor;
+    }
+    /* values numbered by ModDict itself are stored natively */
+    if (typed == Py_None)
+        param->typed = (!value && !PyDict_Check(iterable) &&
+                        !ModDict_Check(iterable));
+    else if ((param->typed = PyObject_IsTrue(typed)) < 0)
+        return -1;
+    /* a ModDict keeps its key width */
+    if (key_bits)
+        param->key_bits = key_bits;
+    else if (ModDict_Check(iterable))
+        param->key_bits = ((ModDictObject *) iterable)->key_itemsize * 8;
+    /* and whether its keys are hashed */
+    if (hashed == Py_None)
+        param->hashed = (ModDict_Check(iterable) &&
+                         ((ModDictObject *) iterable)->hashed);
+    else if ((param->hashed = PyObject_IsTrue(hashed)) < 0)
+        return -1;
+    if (seed != Py_None) {
+        lseed = PyLong_AsUnsignedLong(seed);
+        if (lseed == (unsigned long) -1 && PyErr_Occurred())
+            return -1;
+        if (lseed > 0xffffffff) {
+            PyErr_SetString(PyExc_ValueError, "seed must be in 0..0xffffffff");
+            return -1;
+        }
+        param->seed = (int64_t) lseed;
+    }
+    if (ModDictParam_check(param) < 0)
+        return -1;
+    *riterable = iterable;
+    *rvalue = value;
+    return 0;
+}
+
+static int
+ModDict_init(ModDictObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *iterable, *value;
+    ModDictParam param = ModDictParam_default;
+
+    ModDictSource src = { NULL, };
+    ModDictBuffer buffer;
+    int result = -1;
+
+    /* readers take no lock, so the tables must not be rebuilt under them */
+    if (self->divisor_) {
+        PyErr_SetString(PyExc_TypeError, "ModDict is already initialized");
+        return -1;
+    }
+    ModDict_clear(self);
+
+    if (ModDict_parse_args(args, kwargs, &iterable, &value, &param) < 0)
+        return -1;
+    src.key_itemsize = param.key_bits / 8;
+    src.hashed = param.hashed;
+    src.reseed = (param.seed < 0);
+    src.seed = (param.seed < 0) ? 0 : (uint32_t) param.seed;
+    src.defval = value;
+    if (src.hashed && !PyDict_Check(iterable) && !ModDict_Check(iterable))
+        result = ModDictSource_from_keys(&src, iterable);
+    else if (PyDict_Check(iterable))
+        result = ModDictSource_from_dict(&src, iterable);
+    else if (ModDict_Check(iterable))
+        result = ModDictSource_from_moddict(&src, (ModDictObject *) iterable);
+    else if ((result = ModDictBuffer_get(&buffer, iterable, false)) > 0) {
+        result = ModDictSource_from_buffer(&src, &buffer);
+        ModDictBuffer_release(&buffer);
+    }
+    else if (result == 0)
+        result = ModDictSource_from_iterable(&src, iterable);
+    if (result == 0)
+        result = ModDict_create_table(self, &src, &param);
+    ModDictSource_fini(&src);
+    return result;
+}
+
+static void
+ModDict_dealloc(ModDictObject *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+
     Py_XDECREF(self->divisor_);
-    Py_XDECREF(self->keys);
     Py_XDECREF(self->values);
-    PyMem_Free(self->remainder);
-    PyMem_Free(self->rem_keys);
+    Py_XDECREF(self->keys);
+    ModDict_free_tables(self);
+    PyMem_Free(self->order);
+    type->tp_free((PyObject *) self);
+    Py_DECREF(type);
+}
+
+/* ******** */
+
+static PyObject *
+ModDict_divisor(ModDictObject *self)
+{
+    return IncRef(self->divisor_);
+}
+
+static PyObject *
+ModDict_multiplier(ModDictObject *self)
+{
+    if (!self->div.multiplier)
+        return NewNone();
+    return PyLong_FromUnsignedLongLong(ModDictDivider_multiplier(&self->div,
+                                                                 self->key_itemsize));
+}
+
+static PyObject *
+ModDict_create_mkvtable(PyObject *table, PyObject *defval)
+{
+    PyObject *rval = NULL;
+    PyObject *obj = NULL;
+    Py_ssize_t size, pos;
+
+    size = PyTuple_Size(table);
+    if (!(rval = PyTuple_New(size)))
+        return NULL;
+    for (pos = 0; pos < size; pos++) {
+        obj = PyTuple_GET_ITEM(table, pos);
+        if (IsNull(obj))
+            obj = defval;
+        PyTuple_SET_ITEM(rval, pos, IncRef(obj));
+    }
+    return rval;
+}
+
+/*
+ * builds the remainder table of keys or values through the remainder
+ * index (keys, compact mode, typed values)
+ */
+static PyObject *
+ModDict_create_slot_table(ModDictObject *self, bool values, PyObject *defval)
+{
+    PyObject *rval = NULL;
+    PyObject *obj = NULL;
+    Py_ssize_t rem_pos, index, slot;
+
+    if (!(rval = PyTuple_New(self->table_size)))
+        return NULL;
+    for (rem_pos = 0; rem_pos < self->table_size; rem_pos++) {
+        if ((index = ModDict_remainder_at(self, rem_pos)) < 0)
+            obj = IncRef(defval);
+        else {
+            slot = self->compact ? index : rem_pos;
+            if (values)
+                obj = ModDict_get_remainder_value(self, slot);
+            else
+                obj = ModDict_get_remainder_key(self, slot);
+            if (!obj)
+                goto error;
+        }
+        PyTuple_SET_ITEM(rval, rem_pos, obj);
+    }
+    return rval;
+
+error:
+    Py_XDECREF(rval);
+    return NULL;
+}
+
+static PyObject *
+ModDict_modkeys(ModDictObject *self, PyObject *args)
+{
+    PyObject *defval = Py_None;
+
+    if (!PyArg_ParseTuple(args, "|O", &defval))
+        return NULL;
+    if (!self->divisor)
+        return PyTuple_New(0);
+    return ModDict_create_slot_table(self, false, defval);
+}
+
+static PyObject *
+ModDict_mkvalues(ModDictObject *self, PyObject *args)
+{
+    PyObject *defval = Py_None;
+
+    if (!PyArg_ParseTuple(args, "|O", &defval))
+        return NULL;
+    if (!self->divisor)
+        return PyTuple_New(0);
+    if (self->compact || self->value_itemsize)
+        return ModDict_create_slot_table(self, true, defval);
+    return ModDict_create_mkvtable(self->values, defval);
+}
+
+static PyObject *
+ModDict_remainder_index(ModDictObject *self, PyObject *args)
+{
+    PyObject *defval = Py_None;
+    PyObject *rval = NULL;
+    PyObject *remainder;
+    Py_ssize_t rem_pos, index;
+
+    if (!PyArg_ParseTuple(args, "|O", &defval))
+        return NULL;
+    if (!self->divisor)
+        return PyTuple_New(0);
+    if (!(rval = PyTuple_New(self->table_size)))
+        goto error;
+    for (rem_pos = 0; rem_pos < self->table_size; rem_pos++) {
+        if ((index = ModDict_remainder_at(self, rem_pos)) < 0)
+            remainder = IncRef(defval);
+        else if (!(remainder = PyLong_FromSsize_t(index)))
+            goto error;
+        PyTuple_SET_ITEM(rval, rem_pos, remainder);
+    }
+    return rval;
+
+error:
+    Py_XDECREF(rval);
+    return NULL;
+}
+
+/*
+ * tables owned by the object; the keys and values themselves are shared
+ */
+static Py_ssize_t
+ModDict_sizeof_object(PyObject *obj)
+{
+    PyObject *size;
+    Py_ssize_t rval;
+
+    if (IsNull(obj))
+        return 0;
+    if (!(size = PyObject_CallMethod(obj, "__sizeof__", NULL)))
+        return -1;
+    rval = PyLong_AsSsize_t(size);
+    Py_DECREF(size);
+    return rval;
+}
+
+static PyObject *
+ModDict___sizeof__(ModDictObject *self)
+{
+    Py_ssize_t size, objsize;
+
+    size = Py_TYPE(self)->tp_basicsize;
+    if ((objsize = ModDict_sizeof_object(self->values)) < 0)
+        return NULL;
+    size += objsize;
+    if ((objsize = ModDict_sizeof_object(self->keys)) < 0)
+        return NULL;
+    size += objsize;
+    if (self->order)
+        size += self->size * sizeof(digit);
+    /* mapped tables belong to the page cache */
+    if (self->mapping)
+        return PyLong_FromSsize_t(size);
+    if (self->divisor) {
+        size += self->table_size * self->rem_itemsize;
+        size += (self->compact ? self->size : self->table_size) * self->key_itemsize;
+    }
+    if (self->buckets)
+        size += self->divisor * sizeof(ModDictBucket);
+    if (self->value_itemsize)
+        size += (self->compact ? self->size : self->table_size) * self->value_itemsize;
+    return PyLong_FromSsize_t(size);
+}
+
+static PyObject *
+ModDict_buckets(ModDictObject *self)
+{
+    PyObject *rval = NULL;
+    PyObject *bucket;
+    const ModDictBucket *info;
+    digit pos;
+
+    if (!self->buckets)
+        return NewNone();
+    if (!(rval = PyTuple_New(self->divisor)))
+        return NULL;
+    for (pos = 0; pos < self->divisor; pos++) {
+        info = &self->buckets[pos];
+        if (!(bucket = Py_BuildValue("(kk)", (unsigned long) info->divisor,
+                                     (unsigned long) info->offset))) {
+            Py_DECREF(rval);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(rval, pos, bucket);
+    }
+    return rval;
+}
+
+/*
+ * forindex(iterable): numbers what iterating it yields, so the keys of
+ * a mapping are numbered like a list; a ModDict keeps its key width
+ */
+static PyObject *
+ModDict_forindex(PyObject *klass, PyObject *iterable)
+{
+    ModDictState *state = ModDict_get_state((PyTypeObject *) klass);
+    ModDictObject *source = (ModDictObject *) iterable;
+    PyObject *obj = NULL;
+    PyObject *kwargs = NULL;
+    PyObject *it;
+
+    if (!state || !(it = PyObject_GetIter(iterable)))
+        return NULL;
+    if (ModDict_Check(iterable))
+        kwargs = Py_BuildValue("{sOsisO}", "typed", Py_True,
+                               "key_bits", source->key_itemsize * 8,
+                               "hashed", source->hashed ? Py_True : Py_False);
+    else
+        kwargs = Py_BuildValue("{sO}", "typed", Py_True);
+    if (kwargs)
+        obj = ModDict_from_dict(state->moddict_type, it, kwargs);
+    Py_XDECREF(kwargs);
+    Py_DECREF(it);
+    return obj;
+}
+
+/*
+ * from_buffers(keys, values=None, **options): integer buffers of the
+ * same length.  The keys are read, deduplicated and searched without
+ * the GIL, and the values are stored as typed numbers, so no item
+ * becomes an int object.
+ */
+static PyObject *
+ModDict_from_buffers(PyObject *klass, PyObject *args, PyObject *kwargs)
+{
+    PyTypeObject *type = (PyTypeObject *) klass;
+    ModDictObject *self = NULL;
+    PyObject *values = Py_None;
+    PyObject *kargs = NULL;
+    PyObject *keys, *iterable, *value;
+    ModDictParam param = ModDictParam_default;
+    ModDictSource src = { NULL, };
+    ModDictBuffer keybuf, valbuf;
+    bool has_keys = false, has_values = false;
+    int res;
+
+    if (!PyArg_ParseTuple(args, "O|O:from_buffers", &keys, &values))
+        return NULL;
+    if (!(kargs = PyTuple_Pack(1, keys)))
+        return NULL;
+    if (ModDict_parse_args(kargs, kwargs, &iterable, &value, &param) < 0)
+        goto error;
+    if (param.hashed) {
+        PyErr_SetString(PyExc_TypeError, "from_buffers takes integer keys");
+        goto error;
+    }
+    if (value && values != Py_None) {
+        PyErr_SetString(PyExc_TypeError, "from_buffers takes values or value, not both");
+        goto error;
+    }
+    if ((res = ModDictBuffer_get(&keybuf, keys, false)) == 0)
+        PyErr_SetString(PyExc_TypeError, "keys must be an integer buffer");
+    if (res <= 0)
+        goto error;
+    has_keys = true;
+    if (values != Py_None) {
+        if ((res = ModDictBuffer_get(&valbuf, values, false)) == 0)
+            PyErr_SetString(PyExc_TypeError, "values must be an integer buffer");
+        if (res <= 0)
+            goto error;
+        has_values = true;
+        if (valbuf.length != keybuf.length) {
+            PyErr_SetString(PyExc_ValueError, "values must be as long as keys");
+            goto error;
+        }
+        src.numbers = &valbuf;
+    }
+    src.key_itemsize = param.key_bits / 8;
+    src.defval = value;
+    if (ModDictSource_from_buffer(&src, &keybuf) < 0)
+        goto error;
+    if (!(self = (ModDictObject *) type->tp_alloc(type, 0)))
+        goto error;
+    ModDict_clear(self);
+    if (ModDict_create_table(self, &src, &param) < 0)
+        ClearObject((PyObject **) &self);
+
+error:
+    ModDictSource_fini(&src);
+    if (has_keys)
+        ModDictBuffer_release(&keybuf);
+    if (has_values)
+        ModDictBuffer_release(&valbuf);
+    Py_XDECREF(kargs);
+    return (PyObject *) self;
+}
+
+static PyObject *
+ModDict_call_pickle(const char *name, PyObject *arg)
+{
+    PyObject *pickle;
+    PyObject *rval;
+
+    if (!(pickle = PyImport_ImportModule("pickle")))
+        return NULL;
+    rval = PyObject_CallMethod(pickle, name, "(O)", arg);
+    Py_DECREF(pickle);
+    return rval;
+}
+
+static PyObject *
+ModDict_save(ModDictObject *self, PyObject *arg)
+{
+    ModDictFileHeader header;
+    const void *sections[MODDICT_SECTIONS] = {
+        self->remainder, self->rem_keys, self->buckets, self->numbers, NULL,
+    };
+    PyObject *path = NULL;
+    PyObject *values = NULL;
+    PyObject *keys = NULL;
+    PyObject *blob = NULL;
+    PyObject *rval = NULL;
+    uint64_t offset;
+    bool ok;
+    int pos;
+
+    if (!PyUnicode_FSConverter(arg, &path))
+        return NULL;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODDICT_FILE_MAGIC, sizeof(MODDICT_FILE_MAGIC));
+    header.version = MODDICT_FILE_VERSION;
+    header.byteorder = MODDICT_FILE_BYTEORDER;
+    header.flags = ((self->compact ? MODDICT_FILE_COMPACT : 0) |
+                    (self->buckets ? MODDICT_FILE_BUCKETS : 0) |
+                    (self->key_itemsize == sizeof(uint64_t) ? MODDICT_FILE_KEY64 : 0) |
+                    (self->hashed ? MODDICT_FILE_HASHED : 0) |
+                    (self->div.multiplier ? MODDICT_FILE_MULTIPLY : 0));
+    header.divisor = self->divisor;
+    header.multiplier = ModDictDivider_multiplier(&self->div, self->key_itemsize);
+    header.table_size = self->table_size;
+    header.rem_itemsize = self->rem_itemsize;
+    header.value_itemsize = self->value_itemsize;
+    header.bucket_itemsize = sizeof(ModDictBucket);
+    header.size = self->size;
+    ModDictFile_lengths(&header, header.length);
+
+    if (self->size && (!self->value_itemsize || self->hashed)) {
+        if (!self->value_itemsize && !(values = ModDict_create_list(self, MODDICT_ITEM_VALUE)))
+            goto error;
+        /* hashed keys are pickled with their seed: (seed, keys, values or None) */
+        if (self->hashed) {
+            if (!(keys = ModDict_create_list(self, MODDICT_ITEM_KEY)))
+                goto error;
+            Py_XSETREF(values, Py_BuildValue("(kOO)", (unsigned long) self->seed, keys,
+                                            values ? values : Py_None));
+            if (!values)
+                goto error;
+        }
+        if (!(blob = ModDict_call_pickle("dumps", values)))
+            goto error;
+        if (!PyBytes_Check(blob)) {
+            PyErr_SetString(PyExc_TypeError, "pickle.dumps() did not return bytes");
+            goto error;
+        }
+        sections[MODDICT_SECTION_VALUES] = PyBytes_AS_STRING(blob);
+        header.length[MODDICT_SECTION_VALUES] = PyBytes_GET_SIZE(blob);
+    }
+    offset = sizeof(header);
+    for (pos = 0; pos < MODDICT_SECTIONS; pos++) {
+        offset = (offset + MODDICT_FILE_ALIGN - 1) & ~(uint64_t) (MODDICT_FILE_ALIGN - 1);
+        header.offset[pos] = offset;
+        offset += header.length[pos];
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ok = ModDictFile_write(PyBytes_AS_STRING(path), &header, sections);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, arg);
+        goto error;
+    }
+    rval = NewNone();
+error:
+    Py_XDECREF(path);
+    Py_XDECREF(values);
+    Py_XDECREF(keys);
+    Py_XDECREF(blob);
+    return rval;
+}
+
+/*
+ * checks every occupied slot against its key and fills order
+ * (position in insertion order -> slot); an empty slot must not be
+ * reachable by the key it holds
+ */
+static bool
+ModDict_load_order(ModDictObject *self, digit *order)
+{
+    const ModDictBucket *bucket;
+    ModDictBucket check;
+    Py_ssize_t rem_pos, index, slot, count = 0;
+    digit pos;
+
+    if (self->buckets) {
+        for (pos = 0; pos < self->divisor; pos++) {
+            bucket = &self->buckets[pos];
+            if (!bucket->divisor ||
+                (uint64_t) bucket->offset + bucket->divisor > self->table_size)
+                return false;
+            ModDictBucket_init(&check, bucket->divisor, bucket->offset);
+            if (memcmp(&check, bucket, sizeof(check)))
+                return false;
+        }
+    }
+    for (index = 0; index < self->size; index++)
+        order[index] = self->table_size;
+    for (rem_pos = 0; rem_pos < self->table_size; rem_pos++) {
+        if ((index = ModDict_remainder_at(self, rem_pos)) < 0) {
+            if (!self->compact &&
+                ModDict_slot_of(&self->div, self->buckets,
+                                ModDict_key_at(self, rem_pos)) == rem_pos)
+                return false;
+            continue;
+        }
+        slot = self->compact ? index : rem_pos;
+        if (ModDict_slot_of(&self->div, self->buckets, ModDict_key_at(self, slot)) != rem_pos)
+            return false;
+        if (order[index] != self->table_size)
+            return false;
+        order[index] = slot;
+        count++;
+    }
+    return count == self->size;
+}
+
+/*
+ * copies a section of the read file, or points into the mapped one
+ */
+static void *
+ModDict_load_section(ModDictObject *self, char *base, const ModDictFileHeader *header, int pos)
+{
+    void *table;
+
+    if (!header->length[pos])
+        return NULL;
+    if (self->mapping)
+        return base + header->offset[pos];
+    if (pos == MODDICT_SECTION_BUCKETS)
+        table = PyMem_RawMalloc(header->length[pos]);
+    else
+        table = PyMem_Malloc(header->length[pos]);
+    if (!table)
+        return PyErr_NoMemory();
+    memcpy(table, base + header->offset[pos], header->length[pos]);
+    return table;
 }
 
-/* ******** */
+/*
+ * the pickled keys or values (a list in insertion order) as a table
+ * indexed like rem_keys
+ */
+static PyObject *
+ModDict_load_objects(ModDictObject *self, PyObject *list, const digit *order)
+{
+    PyObject *table;
+    Py_ssize_t pos;
+
+    if (!PyList_CheckExact(list) || PyList_GET_SIZE(list) != self->size) {
+        PyErr_SetString(PyExc_ValueError, "corrupt ModDict file");
+        return NULL;
+    }
+    if (!(table = PyTuple_New(self->compact ? self->size : self->table_size)))
+        return NULL;
+    for (pos = 0; pos < self->size; pos++) {
+        PyTuple_SET_ITEM(table, self->compact ? pos : (Py_ssize_t) order[pos],
+                         IncRef(PyList_GET_ITEM(list, pos)));
+    }
+    return table;
+}
+
+static int
+ModDict_load_tables(ModDictObject *self, char *base, size_t file_size, bool allow_pickle)
+{
+    const ModDictFileHeader *header = (const ModDictFileHeader *) base;
+    const char *reason;
+    PyObject *loaded = NULL;
+    PyObject *blob = NULL;
+    PyObject *keys, *values;
+    digit *order = NULL;
+    Py_ssize_t pos, slot;
+    unsigned long seed;
+    uint64_t nkey;
+    int res = -1;
+
+    if ((reason = ModDictFile_check(header, file_size))) {
+        PyErr_SetString(PyExc_ValueError, reason);
+        return -1;
+    }
+    /* unpickling an untrusted file can run arbitrary code */
+    if (header->length[MODDICT_SECTION_VALUES] && !allow_pickle) {
+        PyErr_SetString(PyExc_ValueError,
+                        "ModDict file holds pickled objects, load it with allow_pickle=True");
+        return -1;
+    }
+    if (!header->size)
+        return 0;
+
+    self->divisor = header->divisor;
+    self->table_size = header->table_size;
+    self->size = header->size;
+    self->rem_itemsize = header->rem_itemsize;
+    self->value_itemsize = header->value_itemsize;
+    self->compact = !!(header->flags & MODDICT_FILE_COMPACT);
+    self->hashed = !!(header->flags & MODDICT_FILE_HASHED);
+    if (header->flags & MODDICT_FILE_KEY64)
+        self->key_itemsize = sizeof(uint64_t);
+    if (header->flags & MODDICT_FILE_MULTIPLY)
+        ModDictDivider_init_multiply(&self->div, __builtin_ctz(self->divisor),
+                                     header->multiplier, self->key_itemsize);
+    else
+        ModDictDivider_init(&self->div, self->divisor);
+    if (!(self->remainder = ModDict_load_section(self, base, header, MODDICT_SECTION_REMAINDER)) ||
+        !(self->rem_keys = ModDict_load_section(self, base, header, MODDICT_SECTION_REM_KEYS)))
+        goto error;
+    if ((header->flags & MODDICT_FILE_BUCKETS) &&
+        !(self->buckets = ModDict_load_section(self, base, header, MODDICT_SECTION_BUCKETS)))
+        goto error;
+    if (self->value_itemsize &&
+        !(self->numbers = ModDict_load_section(self, base, header, MODDICT_SECTION_NUMBERS)))
+        goto error;
+    if (!(self->divisor_ = PyLong_FromUnsignedLong(self->divisor)))
+        goto error;
+
+    if (!(order = PyMem_Malloc(self->size * sizeof(digit))))
+        goto nomemory;
+    if (!ModDict_load_order(self, order))
+        goto corrupt;
+
+    if (!self->value_itemsize || self->hashed) {
+        if (!(blob = PyMemoryView_FromMemory(base + header->offset[MODDICT_SECTION_VALUES],
+                                             header->length[MODDICT_SECTION_VALUES],
+                                             PyBUF_READ)))
+            goto error;
+        if (!(loaded = ModDict_call_pickle("loads", blob)))
+            goto error;
+        values = loaded;
+        if (self->hashed) {
+            /* (seed, keys, values or None) */
+            if (!PyTuple_CheckExact(loaded) || PyTuple_GET_SIZE(loaded) != 3)
+                goto corrupt;
+            seed = PyLong_AsUnsignedLong(PyTuple_GET_ITEM(loaded, 0));
+            if (seed > 0xffffffff) {
+                PyErr_Clear();
+                goto corrupt;
+            }
+            self->seed = (uint32_t) seed;
+            keys = PyTuple_GET_ITEM(loaded, 1);
+            values = PyTuple_GET_ITEM(loaded, 2);
+            Py_SETREF(self->keys, ModDict_load_objects(self, keys, order));
+            if (!self->keys)
+                goto error;
+            /* each key must be the one its hash stands for */
+            for (pos = 0; pos < self->size; pos++) {
+                slot = self->compact ? pos : (Py_ssize_t) order[pos];
+                if (!ModDict_hash_key(PyList_GET_ITEM(keys, pos), self->seed,
+                                      self->key_itemsize, &nkey) ||
+                    nkey != ModDict_key_at(self, slot))
+                    goto corrupt;
+            }
+        }
+        if (!self->value_itemsize) {
+            Py_SETREF(self->values, ModDict_load_objects(self, values, order));
+            if (!self->values)
+                goto error;
+        }
+    }
+
+    if (!self->compact) {
+        self->order = order;
+        order = NULL;
+    }
+    res = 0;
+    goto done;
+
+nomemory:
+    PyErr_NoMemory();
+    goto error;
+corrupt:
+    PyErr_SetString(PyExc_ValueError, "corrupt ModDict file");
+error:
+done:
+    Py_XDECREF(blob);
+    Py_XDECREF(loaded);
+    PyMem_Free(order);
+    return res;
+}
 
 static PyObject *
-ModDict_divisor(ModDictObject *self)
+ModDict_load(PyObject *klass, PyObject *args, PyObject *kwargs)
 {
-    return IncRef(self->divisor_);
+    static char *kwlist[] = {"path", "mmap", "allow_pickle", NULL};
+
+    PyTypeObject *type = (PyTypeObject *) klass;
+    ModDictObject *self = NULL;
+    PyObject *arg = NULL;
+    PyObject *path = NULL;
+    int mapped = true;
+    int allow_pickle = false;
+    void *base = NULL;
+    size_t size = 0;
+    bool ok;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|p$p", kwlist, &arg, &mapped,
+                                     &allow_pickle))
+        return NULL;
+    if (!PyUnicode_FSConverter(arg, &path))
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    ok = ModDictFile_open(PyBytes_AS_STRING(path), mapped, &base, &size);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, arg);
+        goto error;
+    }
+    if (!(self = (ModDictObject *) type->tp_alloc(type, 0)))
+        goto error;
+    ModDict_clear(self);
+    if (mapped && base) {
+        /* owned by self from here on */
+        self->mapping = base;
+        self->mapping_size = size;
+        base = NULL;
+    }
+    if (ModDict_load_tables(self, self->mapping ? self->mapping : base, size, allow_pickle) < 0)
+        ClearObject((PyObject **) &self);
+
+error:
+    if (base && mapped)
+        munmap(base, size);
+    else
+        PyMem_RawFree(base);
+    Py_XDECREF(path);
+    return (PyObject *) self;
+}
+
+/*
+ * Iterator: keys, values or items in insertion order
+ */
+
+typedef struct ModDictIterObject {
+    PyObject_HEAD
+    ModDictObject *dict;
+    Py_ssize_t pos;
+    int kind;
+} ModDictIterObject;
+
+static PyObject *
+ModDictIter_new(ModDictObject *dict, int kind)
+{
+    ModDictState *state = ModDict_get_state(Py_TYPE(dict));
+    ModDictIterObject *it;
+
+    if (!state || !(it = PyObject_New(ModDictIterObject, state->iter_type)))
+        return NULL;
+    it->dict = (ModDictObject *) IncRef((PyObject *) dict);
+    it->pos = 0;
+    it->kind = kind;
+    return (PyObject *) it;
+}
+
+static void
+ModDictIter_dealloc(ModDictIterObject *it)
+{
+    PyTypeObject *type = Py_TYPE(it);
+
+    Py_XDECREF(it->dict);
+    PyObject_Free(it);
+    Py_DECREF(type);
 }
 
+/* an iterator shared between threads still hands out each position once */
 static PyObject *
-ModDict_create_mkvtable(PyObject *table, PyObject *defval)
+ModDictIter_next(ModDictIterObject *it)
 {
-    PyObject *rval = NULL;
-    PyObject *obj = NULL;
-    Py_ssize_t size, pos;
+    PyObject *item = NULL;
 
-    size = PyTuple_Size(table);
-    if (!(rval = PyTuple_New(size)))
+    Py_BEGIN_CRITICAL_SECTION(it);
+    if (it->dict && it->pos < it->dict->size)
+        item = ModDict_item_at(it->dict, it->pos++, it->kind);
+    else
+        ClearObject((PyObject **) &it->dict);
+    Py_END_CRITICAL_SECTION();
+    return item;
+}
+
+static PyObject *
+ModDictIter___length_hint__(ModDictIterObject *it)
+{
+    Py_ssize_t rest = 0;
+
+    Py_BEGIN_CRITICAL_SECTION(it);
+    if (it->dict && it->pos < it->dict->size)
+        rest = it->dict->size - it->pos;
+    Py_END_CRITICAL_SECTION();
+    return PyLong_FromSsize_t(rest);
+}
+
+static PyMethodDef ModDictIter_methods[] = {
+    {"__length_hint__", (PyCFunction) ModDictIter___length_hint__, METH_NOARGS, NULL},
+    {NULL, NULL, 0, NULL}, /* end */
+};
+
+static PyType_Slot ModDictIter_slots[] = {
+    {Py_tp_dealloc, ModDictIter_dealloc},
+    {Py_tp_iter, PyObject_SelfIter},
+    {Py_tp_iternext, ModDictIter_next},
+    {Py_tp_methods, ModDictIter_methods},
+    {0, NULL}, /* end */
+};
+
+static PyType_Spec ModDictIter_spec = {
+    .name = "ModDict.ModDictIterator",
+    .basicsize = sizeof(ModDictIterObject),
+    .itemsize = 0,
+    .flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE |
+              Py_TPFLAGS_DISALLOW_INSTANTIATION),
+    .slots = ModDictIter_slots,
+};
+
+/*
+ * Views: keys(), values() and items() over the tables
+ */
+
+typedef struct ModDictViewObject {
+    PyObject_HEAD
+    ModDictObject *dict;
+    int kind;
+} ModDictViewObject;
+
+static const char *const ModDictView_names[] = {
+    [MODDICT_ITEM_KEY] = "ModDictKeys",
+    [MODDICT_ITEM_VALUE] = "ModDictValues",
+    [MODDICT_ITEM_PAIR] = "ModDictItems",
+};
+
+static void ModDictView_dealloc(ModDictViewObject *view);
+
+/* the view types are final: they share one tp_dealloc */
+inline static bool
+ModDictView_Check(PyObject *obj)
+{
+    return Py_TYPE(obj)->tp_dealloc == (destructor) ModDictView_dealloc;
+}
+
+static PyObject *
+ModDictView_new(ModDictObject *dict, int kind)
+{
+    ModDictState *state = ModDict_get_state(Py_TYPE(dict));
+    ModDictViewObject *view;
+
+    if (!state || !(view = PyObject_New(ModDictViewObject, state->view_types[kind])))
         return NULL;
-    for (pos = 0; pos < size; pos++) {
-        obj = PyTuple_GET_ITEM(table, pos);
-        if (IsNull(obj))
-            obj = defval;
-        PyTuple_SET_ITEM(rval, pos, IncRef(obj));
+    view->dict = (ModDictObject *) IncRef((PyObject *) dict);
+    view->kind = kind;
+    return (PyObject *) view;
+}
+
+static void
+ModDictView_dealloc(ModDictViewObject *view)
+{
+    PyTypeObject *type = Py_TYPE(view);
+
+    Py_XDECREF(view->dict);
+    PyObject_Free(view);
+    Py_DECREF(type);
+}
+
+static Py_ssize_t
+ModDictView_length(ModDictViewObject *view)
+{
+    return view->dict->size;
+}
+
+static PyObject *
+ModDictView___iter__(ModDictViewObject *view)
+{
+    return ModDictIter_new(view->dict, view->kind);
+}
+
+static int
+ModDictView_contains(ModDictViewObject *view, PyObject *obj)
+{
+    ModDictObject *dict = view->dict;
+    PyObject *value;
+    Py_ssize_t slot, pos;
+    int res;
+
+    switch (view->kind) {
+    case MODDICT_ITEM_KEY:
+        return (ModDict_check_key(dict, obj) >= 0);
+    case MODDICT_ITEM_PAIR:
+        if (!PyTuple_Check(obj) || PyTuple_GET_SIZE(obj) != 2)
+            return 0;
+        if ((slot = ModDict_check_key(dict, PyTuple_GET_ITEM(obj, 0))) < 0)
+            return 0;
+        if (!(value = ModDict_get_remainder_value(dict, slot)))
+            return -1;
+        res = PyObject_RichCompareBool(value, PyTuple_GET_ITEM(obj, 1), Py_EQ);
+        Py_DECREF(value);
+        return res;
+    default:
+        for (pos = 0; pos < dict->size; pos++) {
+            if (!(value = ModDict_item_at(dict, pos, MODDICT_ITEM_VALUE)))
+                return -1;
+            res = PyObject_RichCompareBool(value, obj, Py_EQ);
+            Py_DECREF(value);
+            if (res)
+                return res;
+        }
+        return 0;
     }
+}
+
+static PyObject *
+ModDictView___repr__(ModDictViewObject *view)
+{
+    PyObject *list, *rval;
+
+    if (!(list = ModDict_create_list(view->dict, view->kind)))
+        return NULL;
+    rval = PyUnicode_FromFormat("%s(%R)", ModDictView_names[view->kind], list);
+    Py_DECREF(list);
     return rval;
 }
 
+/*
+ * Set operations.  Between the keys of two ModDicts the native keys of
+ * one are probed in the tables of the other; anything else goes
+ * through a set.
+ */
+
+static ModDictObject *
+ModDictView_keys_of(PyObject *obj)
+{
+    if (ModDictView_Check(obj) && ((ModDictViewObject *) obj)->kind == MODDICT_ITEM_KEY)
+        return ((ModDictViewObject *) obj)->dict;
+    if (ModDict_Check(obj))
+        return (ModDictObject *) obj;
+    return NULL;
+}
+
+/*
+ * adds the keys of a that are (or are not) in b to result, or just
+ * counts them when result is NULL; returns the count, -1 on error
+ */
+static Py_ssize_t
+ModDict_select_keys(PyObject *result, ModDictObject *a, ModDictObject *b, bool in_b)
+{
+    Py_ssize_t pos, slot, count = 0;
+    PyObject *key;
+    uint64_t nkey = 0;
+    bool found;
+
+    for (pos = 0; pos < a->size; pos++) {
+        slot = ModDict_slot_at(a, pos);
+        if (a->hashed || b->hashed) {
+            /* hashes are only comparable under one seed: probe the key */
+            if (!(key = ModDict_get_remainder_key(a, slot)))
+                return -1;
+            found = (ModDict_check_key(b, key) >= 0);
+        }
+        else {
+            nkey = ModDict_key_at(a, slot);
+            found = (b->divisor && ModDict_lookup(b, nkey) >= 0);
+            key = NULL;
+        }
+        if (found == in_b)
+            count++;
+        if (found != in_b || !result) {
+            Py_XDECREF(key);
+            continue;
+        }
+        if (!key && !(key = PyLong_FromUnsignedLongLong(nkey)))
+            return -1;
+        if (PySet_Add(result, key) < 0) {
+            Py_DECREF(key);
+            return -1;
+        }
+        Py_DECREF(key);
+    }
+    return count;
+}
+
+static PyObject *
+ModDictView_set_update(PyObject *self, PyObject *other, const char *update)
+{
+    PyObject *result, *rval;
+
+    if (!(result = PySet_New(self)))
+        return NULL;
+    if (!(rval = PyObject_CallMethod(result, update, "O", other))) {
+        Py_DECREF(result);
+        return NULL;
+    }
+    Py_DECREF(rval);
+    return result;
+}
+
+static PyObject *
+ModDictView_and(PyObject *self, PyObject *other)
+{
+    ModDictObject *a = ModDictView_keys_of(self);
+    ModDictObject *b = ModDictView_keys_of(other);
+    PyObject *result;
+
+    if (!a || !b)
+        return ModDictView_set_update(self, other, "intersection_update");
+    if (!(result = PySet_New(NULL)))
+        return NULL;
+    if ((a->size <= b->size ? ModDict_select_keys(result, a, b, true)
+                            : ModDict_select_keys(result, b, a, true)) < 0)
+        ClearObject(&result);
+    return result;
+}
+
+static PyObject *
+ModDictView_sub(PyObject *self, PyObject *other)
+{
+    ModDictObject *a = ModDictView_keys_of(self);
+    ModDictObject *b = ModDictView_keys_of(other);
+    PyObject *result;
+
+    if (!a || !b)
+        return ModDictView_set_update(self, other, "difference_update");
+    if (!(result = PySet_New(NULL)))
+        return NULL;
+    if (ModDict_select_keys(result, a, b, false) < 0)
+        ClearObject(&result);
+    return result;
+}
+
+static PyObject *
+ModDictView_xor(PyObject *self, PyObject *other)
+{
+    ModDictObject *a = ModDictView_keys_of(self);
+    ModDictObject *b = ModDictView_keys_of(other);
+    PyObject *result;
+
+    if (!a || !b)
+        return ModDictView_set_update(self, other, "symmetric_difference_update");
+    if (!(result = PySet_New(NULL)))
+        return NULL;
+    if (ModDict_select_keys(result, a, b, false) < 0 ||
+        ModDict_select_keys(result, b, a, false) < 0)
+        ClearObject(&result);
+    return result;
+}
+
+static PyObject *
+ModDictView_or(PyObject *self, PyObject *other)
+{
+    return ModDictView_set_update(self, other, "update");
+}
+
+/*
+ * returns: 1 = every item of a is in b, 0 = not, -1 = error
+ */
+static int
+ModDictView_contained_in(PyObject *a, PyObject *b)
+{
+    ModDictObject *ka = ModDictView_keys_of(a);
+    ModDictObject *kb = ModDictView_keys_of(b);
+    PyObject *it, *item;
+    Py_ssize_t count;
+    int res = 1;
+
+    if (ka && kb)
+        return ((count = ModDict_select_keys(NULL, ka, kb, false)) < 0) ? -1 : !count;
+    if (!(it = PyObject_GetIter(a)))
+        return -1;
+    while (res > 0 && (item = PyIter_Next(it))) {
+        res = PySequence_Contains(b, item);
+        Py_DECREF(item);
+    }
+    Py_DECREF(it);
+    return PyErr_Occurred() ? -1 : res;
+}
+
+static PyObject *
+ModDictView_richcompare(PyObject *self, PyObject *other, int op)
+{
+    Py_ssize_t len_self, len_other;
+    int res;
+
+    if (!PyAnySet_Check(other) && !PyDictKeys_Check(other) && !PyDictItems_Check(other) &&
+        !(ModDictView_Check(other) && ((ModDictViewObject *) other)->kind != MODDICT_ITEM_VALUE))
+        Py_RETURN_NOTIMPLEMENTED;
+    if ((len_self = PyObject_Size(self)) < 0 || (len_other = PyObject_Size(other)) < 0)
+        return NULL;
+
+    switch (op) {
+    case Py_EQ:
+    case Py_NE:
+        res = (len_self == len_other) ? ModDictView_contained_in(self, other) : 0;
+        if (res >= 0 && op == Py_NE)
+            res = !res;
+        break;
+    case Py_LT:
+        res = (len_self < len_other) ? ModDictView_contained_in(self, other) : 0;
+        break;
+    case Py_LE:
+        res = (len_self <= len_other) ? ModDictView_contained_in(self, other) : 0;
+        break;
+    case Py_GT:
+        res = (len_self > len_other) ? ModDictView_contained_in(other, self) : 0;
+        break;
+    case Py_GE:
+        res = (len_self >= len_other) ? ModDictView_contained_in(other, self) : 0;
+        break;
+    default:
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    return (res < 0) ? NULL : NewBool(res);
+}
+
+static PyObject *
+ModDictView_isdisjoint(PyObject *self, PyObject *other)
+{
+    ModDictObject *a = ModDictView_keys_of(self);
+    ModDictObject *b = ModDictView_keys_of(other);
+    PyObject *it, *item;
+    Py_ssize_t count;
+    int res = 0;
+
+    if (a && b) {
+        if ((count = (a->size <= b->size ? ModDict_select_keys(NULL, a, b, true)
+                                         : ModDict_select_keys(NULL, b, a, true))) < 0)
+            return NULL;
+        return NewBool(!count);
+    }
+    if (!(it = PyObject_GetIter(other)))
+        return NULL;
+    while (!res && (item = PyIter_Next(it))) {
+        res = PySequence_Contains(self, item);
+        Py_DECREF(item);
+    }
+    Py_DECREF(it);
+    if (res < 0 || PyErr_Occurred())
+        return NULL;
+    return NewBool(!res);
+}
+
+static PyMethodDef ModDictView_methods[] = {
+    {"isdisjoint", (PyCFunction) ModDictView_isdisjoint, METH_O, NULL},
+    {NULL, NULL, 0, NULL}, /* end */
+};
+
+/* keys() and items(): set-like */
+static PyType_Slot ModDictView_set_slots[] = {
+    {Py_tp_dealloc, ModDictView_dealloc},
+    {Py_tp_repr, ModDictView___repr__},
+    {Py_tp_iter, ModDictView___iter__},
+    {Py_sq_length, ModDictView_length},
+    {Py_sq_contains, ModDictView_contains},
+    {Py_nb_subtract, ModDictView_sub},
+    {Py_nb_and, ModDictView_and},
+    {Py_nb_xor, ModDictView_xor},
+    {Py_nb_or, ModDictView_or},
+    {Py_tp_hash, PyObject_HashNotImplemented},
+    {Py_tp_richcompare, ModDictView_richcompare},
+    {Py_tp_methods, ModDictView_methods},
+    {0, NULL}, /* end */
+};
+
+/* values() */
+static PyType_Slot ModDictView_slots[] = {
+    {Py_tp_dealloc, ModDictView_dealloc},
+    {Py_tp_repr, ModDictView___repr__},
+    {Py_tp_iter, ModDictView___iter__},
+    {Py_sq_length, ModDictView_length},
+    {Py_sq_contains, ModDictView_contains},
+    {0, NULL}, /* end */
+};
+
+static PyType_Spec ModDictView_specs[] = {
+    [MODDICT_ITEM_KEY] = {
+        .name = "ModDict.ModDictKeys",
+        .basicsize = sizeof(ModDictViewObject),
+        .itemsize = 0,
+        .flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE |
+                  Py_TPFLAGS_DISALLOW_INSTANTIATION),
+        .slots = ModDictView_set_slots,
+    },
+    [MODDICT_ITEM_VALUE] = {
+        .name = "ModDict.ModDictValues",
+        .basicsize = sizeof(ModDictViewObject),
+        .itemsize = 0,
+        .flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE |
+                  Py_TPFLAGS_DISALLOW_INSTANTIATION),
+        .slots = ModDictView_slots,
+    },
+    [MODDICT_ITEM_PAIR] = {
+        .name = "ModDict.ModDictItems",
+        .basicsize = sizeof(ModDictViewObject),
+        .itemsize = 0,
+        .flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE |
+                  Py_TPFLAGS_DISALLOW_INSTANTIATION),
+        .slots = ModDictView_set_slots,
+    },
+};
+
+/*
+ * Tables: a read-only buffer over one C array of a ModDict, kept alive
+ * by the reference it holds.  Handed out wrapped in a memoryview.
+ */
+
+typedef struct ModDictTableObject {
+    PyObject_HEAD
+    ModDictObject *dict;
+    void *buf;
+    Py_ssize_t length;
+    Py_ssize_t itemsize;
+    const char *format;
+} ModDictTableObject;
+
+static PyObject *
+ModDictTable_view(ModDictObject *dict, void *buf, Py_ssize_t length, int itemsize,
+                  bool is_signed)
+{
+    ModDictState *state = ModDict_get_state(Py_TYPE(dict));
+    ModDictTableObject *table;
+    PyObject *view;
+
+    if (!state || !(table = PyObject_New(ModDictTableObject, state->table_type)))
+        return NULL;
+    table->dict = (ModDictObject *) IncRef((PyObject *) dict);
+    table->buf = buf;
+    table->length = buf ? length : 0;
+    table->itemsize = itemsize;
+    if (itemsize == sizeof(uint16_t))
+        table->format = "H";
+    else if (itemsize == sizeof(uint32_t))
+        table->format = is_signed ? "i" : "I";
+    else
+        table->format = is_signed ? "q" : "Q";
+    view = PyMemoryView_FromObject((PyObject *) table);
+    Py_DECREF(table);
+    return view;
+}
+
+static void
+ModDictTable_dealloc(ModDictTableObject *table)
+{
+    PyTypeObject *type = Py_TYPE(table);
+
+    Py_XDECREF(table->dict);
+    PyObject_Free(table);
+    Py_DECREF(type);
+}
+
+static int
+ModDictTable_getbuffer(ModDictTableObject *table, Py_buffer *view, int flags)
+{
+    if (PyBuffer_FillInfo(view, (PyObject *) table, table->buf,
+                          table->length * table->itemsize, 1, flags) < 0)
+        return -1;
+    view->itemsize = table->itemsize;
+    if (flags & PyBUF_FORMAT)
+        view->format = (char *) table->format;
+    if (flags & PyBUF_ND)
+        view->shape = &table->length;
+    if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)
+        view->strides = &table->itemsize;
+    return 0;
+}
+
+static PyType_Slot ModDictTable_slots[] = {
+    {Py_tp_dealloc, ModDictTable_dealloc},
+    {Py_bf_getbuffer, ModDictTable_getbuffer},
+    {0, NULL}, /* end */
+};
+
+static PyType_Spec ModDictTable_spec = {
+    .name = "ModDict.ModDictTable",
+    .basicsize = sizeof(ModDictTableObject),
+    .itemsize = 0,
+    .flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE |
+              Py_TPFLAGS_DISALLOW_INSTANTIATION),
+    .slots = ModDictTable_slots,
+};
+
+/*
+ * rem_keys(): the native keys, by slot ('I', or 'Q' for key_bits=64);
+ * by insertion order when compact
+ */
 static PyObject *
-ModDict_modkeys(ModDictObject *self, PyObject *args)
+ModDict_rem_keys_table(ModDictObject *self)
 {
-    PyObject *defval = Py_None;
+    Py_ssize_t length = self->compact ? self->size : self->table_size;
 
-    if (!PyArg_ParseTuple(args, "|O", &defval))
-        return NULL;
-    if (!self->divisor)
-        return PyTuple_New(0);
-    return ModDict_create_mkvtable(self->keys, defval);
+    return ModDictTable_view(self, self->rem_keys, length, self->key_itemsize, false);
 }
 
+/*
+ * remainder(): the key index of each slot ('H' or 'I'); empty slots
+ * hold a value not below len(self)
+ */
 static PyObject *
-ModDict_mkvalues(ModDictObject *self, PyObject *args)
+ModDict_remainder_table(ModDictObject *self)
 {
-    PyObject *defval = Py_None;
-
-    if (!PyArg_ParseTuple(args, "|O", &defval))
-        return NULL;
-    if (!self->divisor)
-        return PyTuple_New(0);
-    return ModDict_create_mkvtable(self->values, defval);
+    return ModDictTable_view(self, self->remainder, self->table_size, self->rem_itemsize,
+                             false);
 }
 
+/*
+ * numbers(): the typed values ('i' or 'q'), indexed like rem_keys;
+ * None when the values are objects
+ */
 static PyObject *
-ModDict_remainder_index(ModDictObject *self, PyObject *args)
+ModDict_numbers_table(ModDictObject *self)
 {
-    PyObject *defval = Py_None;
-    PyObject *rval = NULL;
-    PyObject *remainder;
-    Py_ssize_t rem_pos;
-    digit index;
-
-    if (!PyArg_ParseTuple(args, "|O", &defval))
-        return NULL;
-    if (!self->divisor)
-        return PyTuple_New(0);
-    if (!(rval = PyTuple_New(self->divisor)))
-        goto error;
-    for (rem_pos = 0; rem_pos < self->divisor; rem_pos++) {
-        index = self->remainder[rem_pos];
-        if (index >= self->divisor)
-            remainder = IncRef(defval);
-        else if (!(remainder = PyLong_FromUnsignedLong(index)))
-            goto error;
-        PyTuple_SET_ITEM(rval, rem_pos, remainder);
-    }
-    return rval;
+    Py_ssize_t length = self->compact ? self->size : self->table_size;
 
-error:
-    Py_XDECREF(rval);
-    return NULL;
+    if (!self->value_itemsize)
+        Py_RETURN_NONE;
+    return ModDictTable_view(self, self->numbers, length, self->value_itemsize, true);
 }
 
+/*
+ * order(): the slot of each key in insertion order ('I'); None when
+ * compact, where the tables are already in that order
+ */
 static PyObject *
-ModDict_forindex(PyObject *klass, PyObject *iterable)
+ModDict_order_table(ModDictObject *self)
 {
-    PyObject *obj = NULL;
-    PyObject *dict = NULL;
-
-    UNUSED(klass);
-    if ((dict = ModDict_create_dict(iterable, NULL)))
-        obj = ModDict_from_dict(dict);
-    Py_XDECREF(dict);
-    return obj;
+    if (self->compact)
+        Py_RETURN_NONE;
+    return ModDictTable_view(self, self->order, self->size, sizeof(digit), false);
 }
 
 /* ******** */
@@ -644,13 +4338,19 @@ ModDict_forindex(PyObject *klass, PyObject *iterable)
 static PyObject *
 ModDict___repr__(ModDictObject *self)
 {
-    return Py_TYPE(self->dict)->tp_repr(self->dict);
+    PyObject *dict, *rval;
+
+    if (!(dict = ModDict_to_dict(self)))
+        return NULL;
+    rval = PyObject_Repr(dict);
+    Py_DECREF(dict);
+    return rval;
 }
 
 static PyObject *
 ModDict___iter__(ModDictObject *self)
 {
-    return Py_TYPE(self->dict)->tp_iter(self->dict);
+    return ModDictIter_new(self, MODDICT_ITEM_KEY);
 }
 
 static PyObject *
@@ -674,7 +4374,7 @@ ModDict_sequence_contains(ModDictObject *self, PyObject *key)
 static Py_ssize_t
 ModDict_length(ModDictObject *self)
 {
-    return Py_SIZE(self->dict);
+    return self->size;
 }
 
 static PyObject *
@@ -693,74 +4393,523 @@ ModDict_ass_subscript(ModDictObject *self, PyObject *key, PyObject *item)
     return -1;
 }
 
+/*
+ * get(key, default=None): METH_FASTCALL, the arguments are taken
+ * from the vector as they are rather than through PyArg_ParseTuple
+ */
 static PyObject *
-ModDict_get(ModDictObject *self, PyObject *args)
+ModDict_get(ModDictObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-    PyObject *key = NULL;
-    PyObject *defval = Py_None;
-    int rem;
+    Py_ssize_t rem;
 
-    if (!PyArg_ParseTuple(args, "O|O", &key, &defval))
+    if (nargs < 1 || nargs > 2) {
+        PyErr_Format(PyExc_TypeError, "get expected at %s, got %zd",
+                     nargs < 1 ? "least 1 argument" : "most 2 arguments", nargs);
         return NULL;
-    if ((rem = ModDict_check_key(self, key)) >= 0)
+    }
+    if ((rem = ModDict_check_key(self, args[0])) >= 0)
         return ModDict_get_remainder_value(self, rem);
-    return IncRef(defval);
+    return IncRef(nargs > 1 ? args[1] : Py_None);
+}
+
+/*
+ * get_many(keys, default=None, out=None)
+ *
+ * keys: sequence, or integer buffer
+ * out: list, or writable integer buffer (values must be int)
+ */
+static int
+ModDict_store_value(PyObject *out, ModDictBuffer *outbuf, Py_ssize_t pos, PyObject *value)
+{
+    long long number;
+
+    /* out may be the caller's list, changed by another thread meanwhile */
+    if (!outbuf)
+        return PyList_SetItem(out, pos, IncRef(value));
+    number = PyLong_AsLongLong(value);
+    if (number == -1 && PyErr_Occurred())
+        return -1;
+    return ModDictBuffer_store(outbuf, pos, number);
+}
+
+static PyObject *
+ModDict_get_many(ModDictObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = { "keys", "default", "out", NULL, };
+
+    PyObject *keys = NULL;
+    PyObject *defval = Py_None;
+    PyObject *out = Py_None;
+    PyObject *seq = NULL;
+    PyObject *rval = NULL;
+    PyObject *value;
+    ModDictBuffer keybuf, outbuf;
+    bool has_keybuf = false, has_outbuf = false;
+    Py_ssize_t length, pos, slot;
+    uint64_t nkey;
+    int res;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO:get_many", kwlist,
+                                     &keys, &defval, &out))
+        return NULL;
+
+    if ((res = ModDictBuffer_get(&keybuf, keys, false)) < 0)
+        return NULL;
+    if ((has_keybuf = res))
+        length = keybuf.length;
+    else {
+        if (!(seq = PySequence_Fast(keys, "keys must be a sequence or an integer buffer")))
+            return NULL;
+        length = PySequence_Fast_GET_SIZE(seq);
+    }
+
+    if (out == Py_None) {
+        if (!(rval = PyList_New(length)))
+            goto error;
+    }
+    else if (PyList_CheckExact(out)) {
+        if (PyList_GET_SIZE(out) != length)
+            goto size_error;
+        rval = IncRef(out);
+    }
+    else {
+        if ((res = ModDictBuffer_get(&outbuf, out, true)) <= 0) {
+            if (res == 0)
+                PyErr_SetString(PyExc_TypeError, "out must be a list or a writable integer buffer");
+            goto error;
+        }
+        has_outbuf = true;
+        if (outbuf.length != length)
+            goto size_error;
+        rval = IncRef(out);
+    }
+
+    for (pos = 0; pos < length; pos++) {
+        if (has_keybuf)
+            slot = (self->divisor && !self->hashed && ModDictBuffer_key(&keybuf, pos, &nkey)
+                    ? ModDict_lookup(self, nkey) : MODDICT_KEY_FAILED);
+        else
+            slot = ModDict_check_key(self, PySequence_Fast_GET_ITEM(seq, pos));
+        if (slot < 0)
+            res = ModDict_store_value(rval, has_outbuf ? &outbuf : NULL, pos, defval);
+        else if (has_outbuf && self->value_itemsize)
+            res = ModDictBuffer_store(&outbuf, pos, ModDict_slot_number(self, slot));
+        else if (!(value = ModDict_get_remainder_value(self, slot)))
+            goto error;
+        else {
+            res = ModDict_store_value(rval, has_outbuf ? &outbuf : NULL, pos, value);
+            Py_DECREF(value);
+        }
+        if (res < 0)
+            goto error;
+    }
+    goto success;
+
+size_error:
+    PyErr_SetString(PyExc_ValueError, "out must have the same length as keys");
+error:
+    ClearObject(&rval);
+success:
+    if (has_keybuf)
+        ModDictBuffer_release(&keybuf);
+    if (has_outbuf)
+        ModDictBuffer_release(&outbuf);
+    Py_XDECREF(seq);
+    return rval;
+}
+
+/*
+ * contains_many(keys, out=None, bitmap=False)
+ *
+ * keys: integer buffer
+ * out: writable buffer of one byte per key, or one bit per key with
+ *      bitmap (least significant bit first)
+ */
+
+#define MODDICT_NOGIL_THRESHOLD  (1 << 12)
+
+static void
+ModDict_contains_buffer(ModDictObject *self, const ModDictBuffer *keys,
+                        uint8_t *out, bool bitmap)
+{
+    Py_ssize_t pos = 0, length = keys->length;
+    uint64_t nkey;
+    bool found;
+
+    if (bitmap)
+        memset(out, 0, (length + 7) / 8);
+    /* integers are never str or bytes keys */
+    if (!self->divisor || self->hashed) {
+        if (!bitmap)
+            memset(out, 0, length);
+        return;
+    }
+    if (ModDict_contains_kernel && !self->buckets && !self->compact && !self->div.multiplier &&
+        self->key_itemsize == sizeof(digit) &&
+        !keys->is_signed && keys->view.itemsize == sizeof(digit))
+        pos = ModDict_contains_kernel(&self->div, self->rem_keys,
+                                      keys->view.buf, length, out, bitmap);
+    for (; pos < length; pos++) {
+        found = (ModDictBuffer_key(keys, pos, &nkey) && ModDict_lookup(self, nkey) >= 0);
+        if (bitmap)
+            out[pos >> 3] |= found << (pos & 7);
+        else
+            out[pos] = found;
+    }
+}
+
+static PyObject *
+ModDict_contains_many(ModDictObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = { "keys", "out", "bitmap", NULL, };
+
+    PyObject *keys = NULL;
+    PyObject *out = Py_None;
+    PyObject *rval = NULL;
+    ModDictBuffer keybuf;
+    Py_buffer outbuf;
+    Py_ssize_t outlen;
+    int bitmap = false;
+    int res;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O$p:contains_many", kwlist,
+                                     &keys, &out, &bitmap))
+        return NULL;
+    if ((res = ModDictBuffer_get(&keybuf, keys, false)) <= 0) {
+        if (res == 0)
+            PyErr_SetString(PyExc_TypeError, "keys must be an integer buffer");
+        return NULL;
+    }
+    outlen = bitmap ? (keybuf.length + 7) / 8 : keybuf.length;
+
+    if (out == Py_None)
+        rval = PyByteArray_FromStringAndSize(NULL, outlen);
+    else
+        rval = IncRef(out);
+    if (!rval)
+        goto done;
+    if (PyObject_GetBuffer(rval, &outbuf, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS) < 0) {
+        ClearObject(&rval);
+        goto done;
+    }
+    if (outbuf.len != outlen) {
+        PyErr_Format(PyExc_ValueError, "out must have %zd bytes", outlen);
+        PyBuffer_Release(&outbuf);
+        ClearObject(&rval);
+        goto done;
+    }
+
+    if (keybuf.length >= MODDICT_NOGIL_THRESHOLD) {
+        Py_BEGIN_ALLOW_THREADS
+        ModDict_contains_buffer(self, &keybuf, outbuf.buf, bitmap);
+        Py_END_ALLOW_THREADS
+    }
+    else
+        ModDict_contains_buffer(self, &keybuf, outbuf.buf, bitmap);
+    PyBuffer_Release(&outbuf);
+
+done:
+    ModDictBuffer_release(&keybuf);
+    return rval;
 }
 
 static PyObject *
 ModDict_keys(ModDictObject *self)
 {
-    return PyDict_Keys(self->dict);
+    return ModDictView_new(self, MODDICT_ITEM_KEY);
 }
 
 static PyObject *
 ModDict_values(ModDictObject *self)
 {
-    return PyDict_Values(self->dict);
+    return ModDictView_new(self, MODDICT_ITEM_VALUE);
 }
 
 static PyObject *
 ModDict_items(ModDictObject *self)
 {
-    return PyDict_Items(self->dict);
+    return ModDictView_new(self, MODDICT_ITEM_PAIR);
 }
 
 static PyObject *
 ModDict_dict(ModDictObject *self)
 {
-    return PyDict_Copy(self->dict);
+    return ModDict_to_dict(self);
 }
 
 /*
- * Type: ModDict
+ * Incremental rebuild
+ *
+ * with_changes(added=None, removed=None) drops the keys of removed
+ * (missing ones are ignored), then sets the items of added as
+ * dict.update() would.  When each new key lands on an empty slot, or on
+ * the slot of a removed key, the divisor (or the multiplier, or the
+ * first-level modulus) holds and the tables are rebuilt without a
+ * search; only the changes are looked up to tell.  Otherwise the search
+ * resumes from the current divisor.  Values are shared, not copied.
  */
 
-static PySequenceMethods ModDict_as_sequence = {
-    .sq_contains = (objobjproc) ModDict_sequence_contains,
-};
+inline static Py_ssize_t
+ModDict_position_of(ModDictObject *self, Py_ssize_t slot)
+{
+    return self->compact ? slot : ModDict_remainder_at(self, slot);
+}
 
-static PyMappingMethods ModDict_as_mapping = {
-    (lenfunc) ModDict_length,
-    (binaryfunc) ModDict_subscript,
-    (objobjargproc) ModDict_ass_subscript,
-};
+static int
+ModDict_compare_slot(const void *a, const void *b)
+{
+    Py_ssize_t sa = *(const Py_ssize_t *) a, sb = *(const Py_ssize_t *) b;
+
+    return (sa > sb) - (sa < sb);
+}
+
+/*
+ * the key of a change as it is in the tables: false (with KeyError) if
+ * it cannot be one
+ */
+static bool
+ModDict_change_key(ModDictObject *self, PyObject *key, uint64_t *nkey)
+{
+    bool ok;
+
+    if (self->hashed)
+        ok = ModDict_hash_key(key, self->seed, self->key_itemsize, nkey);
+    else
+        ok = (ModDict_convert_key(key, nkey) &&
+              !((*nkey >> 32) && self->key_itemsize == sizeof(digit)));
+    if (!ok)
+        PyErr_SetObject(PyExc_KeyError, key);
+    return ok;
+}
+
+static PyObject *
+ModDict_with_changes(ModDictObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"added", "removed", NULL};
+
+    PyTypeObject *type = Py_TYPE(self);
+    ModDictObject *result = NULL;
+    PyObject *added = Py_None;
+    PyObject *removed = Py_None;
+    PyObject *items = NULL;
+    PyObject *it = NULL;
+    PyObject *key, *val;
+    PyObject **replaced = NULL;
+    PyObject **fresh = NULL;
+    Py_ssize_t *slots = NULL;
+    bool *dropped = NULL;
+    ModDictSource src = { NULL, };
+    ModDictParam param = ModDictParam_default;
+    Py_ssize_t size = self->size, nfresh = 0, ndropped = 0;
+    Py_ssize_t dict_pos = 0, pos, count, slot, rem;
+    uint64_t nkey;
+    bool fits;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$OO:with_changes", kwlist,
+                                     &added, &removed))
+        return NULL;
+    if (added == Py_None)
+        items = PyDict_New();
+    else if (PyDict_CheckExact(added))
+        items = IncRef(added);
+    else
+        items = PyObject_CallFunctionObjArgs((PyObject *) &PyDict_Type, added, NULL);
+    if (!items)
+        return NULL;
+    if (!(dropped = PyMem_Calloc(Py_MAX(size, 1), sizeof(bool))) ||
+        !(replaced = PyMem_Calloc(Py_MAX(size, 1), sizeof(PyObject *))) ||
+        !(fresh = PyMem_Malloc(Py_MAX(PyDict_GET_SIZE(items), 1) * sizeof(PyObject *))) ||
+        !(slots = PyMem_Malloc(Py_MAX(PyDict_GET_SIZE(items), 1) * sizeof(Py_ssize_t)))) {
+        PyErr_NoMemory();
+        goto error;
+    }
+
+    if (removed != Py_None) {
+        if (!(it = PyObject_GetIter(removed)))
+            goto error;
+        while ((key = PyIter_Next(it))) {
+            slot = ModDict_check_key(self, key);
+            Py_DECREF(key);
+            if (slot >= 0 && !dropped[pos = ModDict_position_of(self, slot)]) {
+                dropped[pos] = true;
+                ndropped++;
+            }
+        }
+        if (PyErr_Occurred())
+            goto error;
+    }
+
+    /* a new key fits an empty slot or one a removed key leaves */
+    fits = (self->divisor != 0);
+    while (PyDict_Next(items, &dict_pos, &key, &val)) {
+        if (!ModDict_change_key(self, key, &nkey))
+            goto error;
+        slot = ModDict_check_key(self, key);
+        if (slot >= 0 && !dropped[pos = ModDict_position_of(self, slot)]) {
+            replaced[pos] = val;
+            continue;
+        }
+        if (fits) {
+            rem = ModDict_slot_of(&self->div, self->buckets, nkey);
+            pos = ModDict_remainder_at(self, rem);
+            fits = (pos < 0 || dropped[pos]);
+            slots[nfresh] = rem;
+        }
+        fresh[nfresh++] = key;
+    }
+    if (fits && nfresh > 1) {
+        qsort(slots, nfresh, sizeof(Py_ssize_t), ModDict_compare_slot);
+        for (pos = 1; fits && pos < nfresh; pos++)
+            fits = (slots[pos] != slots[pos - 1]);
+    }
+
+    count = size - ndropped + nfresh;
+    src.key_itemsize = self->key_itemsize;
+    src.hashed = self->hashed;
+    src.seed = self->seed;
+    src.reseed = (self->hashed && !fits);
+    if (ModDictSource_reserve(&src, Py_MAX(count, 1) * 2) < 0)
+        goto error;
+    if (!(src.values = PyTuple_New(count)))
+        goto error;
+    if (src.hashed && !(src.objects = PyTuple_New(count)))
+        goto error;
+    for (count = 0, pos = 0; pos < size; pos++) {
+        if (dropped[pos])
+            continue;
+        slot = ModDict_slot_at(self, pos);
+        if (src.hashed)
+            PyTuple_SET_ITEM(src.objects, count, IncRef(PyTuple_GET_ITEM(self->keys, slot)));
+        else
+            ModDictSource_put(&src, count, ModDict_key_at(self, slot));
+        if (replaced[pos])
+            val = IncRef(replaced[pos]);
+        else if (!(val = ModDict_get_remainder_value(self, slot)))
+            goto error;
+        PyTuple_SET_ITEM(src.values, count, val);
+        count++;
+    }
+    for (pos = 0; pos < nfresh; pos++, count++) {
+        key = fresh[pos];
+        if (src.hashed)
+            PyTuple_SET_ITEM(src.objects, count, IncRef(key));
+        else if (!ModDict_change_key(self, key, &nkey) || !ModDictSource_put(&src, count, nkey))
+            goto error;
+        PyTuple_SET_ITEM(src.values, count, IncRef(PyDict_GetItem(items, key)));
+    }
+    src.size = count;
+
+    param.key_bits = self->key_itemsize * 8;
+    param.hashed = self->hashed;
+    param.compact = self->compact;
+    param.levels = self->buckets ? 2 : 1;
+    param.typed = (self->value_itemsize != 0);
+    param.engine = self->div.multiplier ? MODDICT_ENGINE_MUL : MODDICT_ENGINE_MOD;
+    if (fits || self->buckets) {
+        /* buckets of the same modulus are searched again */
+        param.divisor = self->divisor;
+        param.multiplier = ModDictDivider_multiplier(&self->div, self->key_itemsize);
+    }
+    else if (self->divisor)
+        param.divmin = self->div.multiplier ? self->divisor : self->divisor + 1;
+
+    if (!(result = (ModDictObject *) type->tp_alloc(type, 0)))
+        goto error;
+    ModDict_clear(result);
+    if (ModDict_create_table(result, &src, &param) < 0)
+        ClearObject((PyObject **) &result);
+
+error:
+    ModDictSource_fini(&src);
+    Py_XDECREF(items);
+    Py_XDECREF(it);
+    PyMem_Free(dropped);
+    PyMem_Free(replaced);
+    PyMem_Free(fresh);
+    PyMem_Free(slots);
+    return (PyObject *) result;
+}
+
+/*
+ * pickled as _restore(cls, (mapping,), options): the divisor found here
+ * is only verified when unpickling
+ */
+static PyObject *
+ModDict___reduce__(ModDictObject *self)
+{
+    PyObject *module = NULL;
+    PyObject *restore = NULL;
+    PyObject *mapping = NULL;
+    PyObject *seed = NULL;
+    PyObject *multiplier = NULL;
+    PyObject *rval = NULL;
+
+    if (!(module = PyImport_ImportModule("ModDict")))
+        return NULL;
+    if (!(restore = PyObject_GetAttrString(module, "_restore")))
+        goto error;
+    if (!(mapping = ModDict_dict(self)))
+        goto error;
+    /* the divisor of hashed keys holds under their seed only */
+    if (!(seed = self->hashed ? PyLong_FromUnsignedLong(self->seed) : NewNone()))
+        goto error;
+    if (!(multiplier = ModDict_multiplier(self)))
+        goto error;
+    rval = Py_BuildValue("(O(O(O){sOsOsisOsOsisOsO}))", restore,
+                         (PyObject *) Py_TYPE(self), mapping,
+                         "divisor", self->divisor_,
+                         "multiplier", multiplier,
+                         "key_bits", self->key_itemsize * 8,
+                         "hashed", self->hashed ? Py_True : Py_False,
+                         "seed", seed,
+                         "levels", self->buckets ? 2 : 1,
+                         "compact", self->compact ? Py_True : Py_False,
+                         "typed", self->value_itemsize ? Py_True : Py_False);
+error:
+    Py_XDECREF(module);
+    Py_XDECREF(restore);
+    Py_XDECREF(mapping);
+    Py_XDECREF(seed);
+    Py_XDECREF(multiplier);
+    return rval;
+}
+
+/*
+ * Type: ModDict
+ */
 
 static PyMethodDef ModDict_methods[] = {
-    {"__contains__", (PyCFunction) ModDict___contains__, METH_O, NULL},
-    {"__getitem__", (PyCFunction) ModDict___getitem__, METH_O, NULL},
+    /* METH_COEXIST: called directly, not through the slot wrappers */
+    {"__contains__", (PyCFunction) ModDict___contains__, METH_O | METH_COEXIST, NULL},
+    {"__getitem__", (PyCFunction) ModDict___getitem__, METH_O | METH_COEXIST, NULL},
 
     {"divisor", (PyCFunction) ModDict_divisor, METH_NOARGS, NULL},
+    {"multiplier", (PyCFunction) ModDict_multiplier, METH_NOARGS, NULL},
     {"modkeys", (PyCFunction) ModDict_modkeys, METH_VARARGS, NULL},
     {"mkvalues", (PyCFunction) ModDict_mkvalues, METH_VARARGS, NULL},
     {"remainder_index", (PyCFunction) ModDict_remainder_index, METH_VARARGS, NULL},
+    {"rem_keys", (PyCFunction) ModDict_rem_keys_table, METH_NOARGS, NULL},
+    {"remainder", (PyCFunction) ModDict_remainder_table, METH_NOARGS, NULL},
+    {"numbers", (PyCFunction) ModDict_numbers_table, METH_NOARGS, NULL},
+    {"order", (PyCFunction) ModDict_order_table, METH_NOARGS, NULL},
+    {"buckets", (PyCFunction) ModDict_buckets, METH_NOARGS, NULL},
     {"forindex", (PyCFunction) ModDict_forindex, METH_O | METH_CLASS, NULL},
+    {"from_buffers", (PyCFunction) ModDict_from_buffers,
+     METH_VARARGS | METH_KEYWORDS | METH_CLASS, NULL},
+    {"save", (PyCFunction) ModDict_save, METH_O, NULL},
+    {"load", (PyCFunction) ModDict_load, METH_VARARGS | METH_KEYWORDS | METH_CLASS, NULL},
+    {"__sizeof__", (PyCFunction) ModDict___sizeof__, METH_NOARGS, NULL},
 
-    {"get", (PyCFunction) ModDict_get, METH_VARARGS, NULL},
+    {"get", (PyCFunction) ModDict_get, METH_FASTCALL, NULL},
+    {"get_many", (PyCFunction) ModDict_get_many, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"contains_many", (PyCFunction) ModDict_contains_many, METH_VARARGS | METH_KEYWORDS, NULL},
     {"keys", (PyCFunction) ModDict_keys, METH_NOARGS, NULL},
     {"values", (PyCFunction) ModDict_values, METH_NOARGS, NULL},
     {"items", (PyCFunction) ModDict_items, METH_NOARGS, NULL},
 
     {"dict", (PyCFunction) ModDict_dict, METH_NOARGS, NULL},
+    {"with_changes", (PyCFunction) ModDict_with_changes, METH_VARARGS | METH_KEYWORDS, NULL},
+    {"__reduce__", (PyCFunction) ModDict___reduce__, METH_NOARGS, NULL},
 
 #if PY_VERSION_HEX >= 0x03090000
     {"__class_getitem__", (PyCFunction) Py_GenericAlias, METH_O | METH_CLASS, NULL},
@@ -770,69 +4919,169 @@ static PyMethodDef ModDict_methods[] = {
 };
 
 
-#undef ModDictType
-static PyTypeObject ModDictType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "ModDict.ModDict",
-    .tp_doc = "ModDict object",
-    .tp_basicsize = sizeof(ModDictObject),
-    .tp_itemsize = 0,
-    .tp_flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE |
-                 Py_TPFLAGS_DICT_SUBCLASS | Py_TPFLAGS_MAPPING),
-
-    .tp_new = PyType_GenericNew,
-    .tp_init = (initproc) ModDict_init,
-    .tp_finalize = (destructor) ModDict_finalize,
+static PyType_Slot ModDict_slots[] = {
+    {Py_tp_doc, "ModDict object"},
+    {Py_tp_new, PyType_GenericNew},
+    {Py_tp_init, ModDict_init},
+    {Py_tp_dealloc, ModDict_dealloc},
 
-    .tp_repr = (reprfunc) ModDict___repr__,
-    .tp_str = (reprfunc) ModDict___repr__,
+    {Py_tp_repr, ModDict___repr__},
+    {Py_tp_str, ModDict___repr__},
 
-    .tp_as_sequence = &ModDict_as_sequence,
-    .tp_as_mapping = &ModDict_as_mapping,
-    .tp_methods = ModDict_methods,
+    {Py_sq_contains, ModDict_sequence_contains},
+    {Py_mp_length, ModDict_length},
+    {Py_mp_subscript, ModDict_subscript},
+    {Py_mp_ass_subscript, ModDict_ass_subscript},
+    {Py_tp_methods, ModDict_methods},
 
-    .tp_iter = (getiterfunc) ModDict___iter__,
+    {Py_tp_iter, ModDict___iter__},
+    {0, NULL}, /* end */
 };
 
-inline static PyTypeObject *
-get_moddict_type()
-{
-    return &ModDictType;
-}
+static PyType_Spec ModDict_spec = {
+    .name = "ModDict.ModDict",
+    .basicsize = sizeof(ModDictObject),
+    .itemsize = 0,
+    .flags = (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_MAPPING |
+              Py_TPFLAGS_IMMUTABLETYPE),
+    .slots = ModDict_slots,
+};
 
 
 /*
  * Module: ModDict
  */
 
-typedef struct ModDictState {
-    PyObject *error;
-} ModDictState;
+static PyObject *
+ModDict__restore(PyObject *module, PyObject *args)
+{
+    PyObject *klass, *cargs, *kwargs;
+
+    UNUSED(module);
+    if (!PyArg_ParseTuple(args, "OO!O!:_restore", &klass, &PyTuple_Type, &cargs,
+                          &PyDict_Type, &kwargs))
+        return NULL;
+    return PyObject_Call(klass, cargs, kwargs);
+}
+
+static PyMethodDef ModDict_module_methods[] = {
+    {"_restore", (PyCFunction) ModDict__restore, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL}, /* end */
+};
+
+static int
+ModDict_exec(PyObject *module)
+{
+    ModDictState *state = PyModule_GetState(module);
+    int kind;
+
+    pthread_once(&ModDict_kernel_once, ModDict_select_kernel);
+    if (!(state->moddict_type = (PyTypeObject *)
+          PyType_FromModuleAndSpec(module, &ModDict_spec, NULL)))
+        return -1;
+    if (!(state->iter_type = (PyTypeObject *)
+          PyType_FromModuleAndSpec(module, &ModDictIter_spec, NULL)))
+        return -1;
+    for (kind = MODDICT_ITEM_KEY; kind <= MODDICT_ITEM_PAIR; kind++) {
+        if (!(state->view_types[kind] = (PyTypeObject *)
+              PyType_FromModuleAndSpec(module, &ModDictView_specs[kind], NULL)))
+            return -1;
+    }
+    if (!(state->table_type = (PyTypeObject *)
+          PyType_FromModuleAndSpec(module, &ModDictTable_spec, NULL)))
+        return -1;
+    return PyModule_AddType(module, state->moddict_type);
+}
+
+static int
+ModDict_traverse(PyObject *module, visitproc visit, void *arg)
+{
+    ModDictState *state = PyModule_GetState(module);
+    int kind;
+
+    Py_VISIT(state->moddict_type);
+    Py_VISIT(state->iter_type);
+    for (kind = MODDICT_ITEM_KEY; kind <= MODDICT_ITEM_PAIR; kind++)
+        Py_VISIT(state->view_types[kind]);
+    Py_VISIT(state->table_type);
+    return 0;
+}
+
+static int
+ModDict_module_clear(PyObject *module)
+{
+    ModDictState *state = PyModule_GetState(module);
+    int kind;
+
+    Py_CLEAR(state->moddict_type);
+    Py_CLEAR(state->iter_type);
+    for (kind = MODDICT_ITEM_KEY; kind <= MODDICT_ITEM_PAIR; kind++)
+        Py_CLEAR(state->view_types[kind]);
+    Py_CLEAR(state->table_type);
+    return 0;
+}
+
+static void
+ModDict_module_free(void *module)
+{
+    ModDict_module_clear((PyObject *) module);
+}
+
+static PyModuleDef_Slot ModDict_module_slots[] = {
+    {Py_mod_exec, ModDict_exec},
+#if PY_VERSION_HEX >= 0x030C0000
+    {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#if defined(Py_GIL_DISABLED) && PY_VERSION_HEX >= 0x030D0000
+    /* tables are immutable once built; iterators lock themselves */
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}, /* end */
+};
 
 static PyModuleDef ModDict_def = {
     PyModuleDef_HEAD_INIT,
     .m_name = "ModDict",
-    .m_doc = "extension module for read-only dictionary with key as 32-bit unsigned integer.",
-    .m_size = -1,
+    .m_doc = "extension module for read-only dictionary with key as 32 or 64-bit unsigned integer.",
+    .m_size = sizeof(ModDictState),
+    .m_methods = ModDict_module_methods,
+    .m_slots = ModDict_module_slots,
+    .m_traverse = ModDict_traverse,
+    .m_clear = ModDict_module_clear,
+    .m_free = ModDict_module_free,
 };
 
-PyMODINIT_FUNC
-PyInit_ModDict(void)
+/*
+ * the state of the module that made type (or a base of it)
+ */
+static ModDictState *
+ModDict_get_state(PyTypeObject *type)
 {
-    PyObject *module;
-
-    if (PyType_Ready(&ModDictType) < 0)
-        return NULL;
-    if (!(module = PyModule_Create(&ModDict_def)))
-        return NULL;
+    PyObject *module = NULL;
+#if PY_VERSION_HEX >= 0x030B0000
+    module = PyType_GetModuleByDef(type, &ModDict_def);
+#else
+    PyObject *mro = type->tp_mro;
+    PyTypeObject *base;
+    Py_ssize_t pos;
 
-    Py_INCREF(&ModDictType);
-    if (PyModule_AddObject(module, "ModDict", (PyObject *) &ModDictType) < 0) {
-        Py_DECREF(module);
-        Py_DECREF(&ModDictType);
-        return NULL;
+    for (pos = 0; !module && mro && pos < PyTuple_GET_SIZE(mro); pos++) {
+        base = (PyTypeObject *) PyTuple_GET_ITEM(mro, pos);
+        if (PyType_HasFeature(base, Py_TPFLAGS_HEAPTYPE) &&
+            ((PyHeapTypeObject *) base)->ht_module &&
+            PyModule_GetDef(((PyHeapTypeObject *) base)->ht_module) == &ModDict_def)
+            module = ((PyHeapTypeObject *) base)->ht_module;
     }
-    return module;
+    if (!module)
+        PyErr_Format(PyExc_TypeError, "%s is not a ModDict type", type->tp_name);
+#endif
+    return module ? (ModDictState *) PyModule_GetState(module) : NULL;
+}
+
+PyMODINIT_FUNC
+PyInit_ModDict(void)
+{
+    return PyModuleDef_Init(&ModDict_def);
 }
 
 /*
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+#
+# engine='mod' against engine='mul': construction time, table slots per
+# key, hit/miss latency of get and get_many throughput over several
+# kinds of key sets.
+#
+#   python3 bench/engine.py [repeat]
+#
+
+import array
+import glob
+import os
+import random
+import sys
+import time
+from collections import deque
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+from ModDict import ModDict
+
+PROBES = 200000
+
+
+def key_sets():
+    random.seed(0)
+    yield 'random 100', random.sample(range(1 << 32), 100)
+    yield 'random 1000', random.sample(range(1 << 32), 1000)
+    yield 'random 3000', random.sample(range(1 << 32), 3000)
+    yield 'dense 20000', random.sample(range(40000), 20000)
+    keys = set()
+    for base in random.sample(range(1 << 30), 10):
+        keys.update(random.sample(range(base, base + 1000), 100))
+    yield 'clustered 1000', list(keys)
+    yield 'progression 5000', [12345 + k * 720720 for k in range(5000)]
+    yield 'stride 10000', [k * 64 for k in range(10000)]
+
+
+def best_of(repeat, func):
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        func()
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    repeat = int(sys.argv[1]) if len(sys.argv) > 1 else 3
+
+    print('%-18s %-4s %10s %9s %10s %8s %8s %9s' % (
+        '', '', 'build', 'slots', 'slots/key', 'hit', 'miss', 'get_many'))
+    for name, keys in key_sets():
+        hits = (keys * (PROBES // len(keys) + 1))[:PROBES]
+        random.shuffle(hits)
+        present = set(keys)
+        misses = [k + 1 for k in hits if k + 1 not in present] or hits
+        hitbuf = array.array('I', hits)
+        for engine in ('mod', 'mul'):
+            mdict = None
+
+            def build():
+                nonlocal mdict
+                mdict = ModDict(keys, engine=engine)
+
+            elapsed = best_of(repeat, build)
+            hit = best_of(repeat, lambda: deque(map(mdict.get, hits), 0)) * 1e9 / len(hits)
+            miss = best_of(repeat, lambda: deque(map(mdict.get, misses), 0)) * 1e9 / len(misses)
+            batch = best_of(repeat, lambda: mdict.get_many(hitbuf))
+            print('%-18s %-4s %8.2fms %9d %10.1f %6.1fns %6.1fns %6.1fM/s' % (
+                name, engine, elapsed * 1e3, mdict.divisor(), mdict.divisor() / len(keys),
+                hit, miss, len(hits) / batch / 1e6))
+
+
+if __name__ == '__main__':
+    main()
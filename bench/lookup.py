@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+#
+# Per-lookup latency of ModDict.__getitem__, get and __contains__.
+#
+#   python3 bench/lookup.py [size [repeat]]
+#
+
+import glob
+import os
+import random
+import sys
+import time
+from collections import deque
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+from ModDict import ModDict
+
+
+def measure(func, keys, repeat):
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        deque(map(func, keys), 0)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best * 1e9 / len(keys)
+
+
+def main():
+    size = int(sys.argv[1]) if len(sys.argv) > 1 else 1000
+    repeat = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+
+    random.seed(0)
+    keys = random.sample(range(1 << 20), size)
+    miss = [k + (1 << 20) for k in keys]
+    mapping = {k: n for n, k in enumerate(keys)}
+    mdict = ModDict(mapping)
+
+    hits = keys * max(1, 1000000 // size)
+    misses = miss * max(1, 1000000 // size)
+
+    print('size=%d divisor=%d' % (size, mdict.divisor()))
+    print('%-24s %10s %10s' % ('', 'ModDict', 'dict'))
+    rows = [
+        ('__getitem__ (hit)', mdict.__getitem__, mapping.__getitem__, hits),
+        ('get (hit)', mdict.get, mapping.get, hits),
+        ('get (miss)', mdict.get, mapping.get, misses),
+        ('__contains__ (hit)', mdict.__contains__, mapping.__contains__, hits),
+        ('__contains__ (miss)', mdict.__contains__, mapping.__contains__, misses),
+    ]
+    for name, mfunc, dfunc, data in rows:
+        print('%-24s %8.1fns %8.1fns' % (
+            name, measure(mfunc, data, repeat), measure(dfunc, data, repeat)))
+
+
+if __name__ == '__main__':
+    main()
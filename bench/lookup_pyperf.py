@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+#
+# pyperf version of bench/lookup.py: ModDict against dict for hits,
+# misses and keys that are not int.
+#
+#   python3 bench/lookup_pyperf.py [--size N] [pyperf options]
+#   python3 -m pyperf compare_to dict.json moddict.json
+#
+
+import glob
+import os
+import random
+import sys
+from collections import deque
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+import pyperf
+
+from ModDict import ModDict
+
+
+def time_map(loops, func, keys):
+    timer = pyperf.perf_counter
+    start = timer()
+    for _ in range(loops):
+        deque(map(func, keys), 0)
+    return timer() - start
+
+
+def main():
+    runner = pyperf.Runner()
+    runner.argparser.add_argument('--size', type=int, default=1000)
+    args = runner.parse_args()
+
+    random.seed(0)
+    keys = random.sample(range(1 << 20), args.size)
+    mapping = {k: n for n, k in enumerate(keys)}
+    mdict = ModDict(mapping)
+
+    cases = [
+        ('hit', keys),
+        ('miss', [k + (1 << 20) for k in keys]),
+        ('str', [str(k) for k in keys]),
+        ('float', [float(k) for k in keys]),
+    ]
+    for kind, data in cases:
+        for name, obj in (('ModDict', mdict), ('dict', mapping)):
+            tests = [('get', obj.get), ('__contains__', obj.__contains__)]
+            if kind == 'hit':
+                tests.append(('__getitem__', obj.__getitem__))
+            for method, func in tests:
+                runner.bench_time_func('%s.%s (%s)' % (name, method, kind),
+                                       time_map, func, data, inner_loops=len(data))
+
+
+if __name__ == '__main__':
+    main()
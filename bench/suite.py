@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+#
+# ModDict against dict, frozenset and a list indexed by key: construction
+# time, memory per key, hit/miss latency and batch throughput over
+# random, dense and clustered key sets of several sizes.
+#
+#   python3 bench/suite.py [--sizes 100,1000,...] [--dists random,dense,clustered]
+#                          [--repeat N]
+#   make bench BENCHARGS='--sizes 1000,100000'
+#
+# ModDict uses levels=1 where the divisor search is quick (small or
+# dense sets) and levels=2 elsewhere.  The list index only exists when
+# the keys span at most MAX_SPAN.  Memory counts the containers, not
+# the int objects they refer to.
+#
+
+import argparse
+import array
+import glob
+import os
+import random
+import sys
+import time
+from collections import deque
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+from ModDict import ModDict
+
+SIZES = [100, 1000, 10000, 100000, 1000000]
+DISTS = ['random', 'dense', 'clustered']
+PROBES = 200000
+MAX_SPAN = 1 << 24
+LEVEL1_MAX = 1000
+
+
+def random_keys(size):
+    return random.sample(range(1 << 32), size)
+
+
+def dense_keys(size):
+    return random.sample(range(size * 2), size)
+
+
+def clustered_keys(size):
+    keys = set()
+    while len(keys) < size:
+        base = random.randrange(1 << 31)
+        keys.update(random.sample(range(base, base + 4096), 1024))
+    keys = list(keys)
+    random.shuffle(keys)
+    return keys[:size]
+
+
+def miss_keys(keys, count):
+    """keys of the same kind that are not in keys"""
+    present = set(keys)
+    low, high = min(keys), max(keys)
+    misses = []
+    while len(misses) < count:
+        key = random.randint(low, high) if len(present) < high - low + 1 else high + 1
+        if key not in present:
+            misses.append(key)
+    return misses
+
+
+def best_of(repeat, func):
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        func()
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def per_call(repeat, func, probes):
+    return best_of(repeat, lambda: deque(map(func, probes), 0)) * 1e9 / len(probes)
+
+
+def bench_one(dist, size, repeat):
+    keys = globals()[dist + '_keys'](size)
+    hits = (keys * (PROBES // size + 1))[:PROBES]
+    random.shuffle(hits)
+    misses = miss_keys(keys, min(PROBES, 20000)) * max(1, PROBES // 20000)
+    span = max(keys) + 1
+    levels = 1 if size <= LEVEL1_MAX or dist == 'dense' else 2
+
+    mdict = None
+    mapping = None
+    fset = None
+    index = None
+
+    def build_moddict():
+        nonlocal mdict
+        mdict = ModDict(keys, levels=levels)
+
+    def build_dict():
+        nonlocal mapping
+        mapping = {k: n for n, k in enumerate(keys)}
+
+    def build_frozenset():
+        nonlocal fset
+        fset = frozenset(keys)
+
+    def build_index():
+        nonlocal index
+        index = [None] * span
+        for n, k in enumerate(keys):
+            index[k] = n
+
+    rows = [
+        ('ModDict' + (' levels=2' if levels == 2 else ''), build_moddict),
+        ('dict', build_dict),
+        ('frozenset', build_frozenset),
+    ]
+    if span <= MAX_SPAN:
+        rows.append(('list index', build_index))
+
+    hitbuf = array.array('I', hits)
+    print('%s %d keys (span %d)' % (dist, size, span))
+    print('  %-18s %10s %8s %9s %9s %10s' % (
+        '', 'build', 'B/key', 'hit', 'miss', 'batch'))
+    for name, build in rows:
+        elapsed = best_of(repeat, build)
+        if name.startswith('ModDict'):
+            memory = sys.getsizeof(mdict)
+            hit = per_call(repeat, mdict.get, hits)
+            miss = per_call(repeat, mdict.get, misses)
+            batch = best_of(repeat, lambda: mdict.get_many(hitbuf))
+        elif name == 'dict':
+            memory = sys.getsizeof(mapping)
+            hit = per_call(repeat, mapping.get, hits)
+            miss = per_call(repeat, mapping.get, misses)
+            batch = best_of(repeat, lambda: list(map(mapping.get, hits)))
+        elif name == 'frozenset':
+            memory = sys.getsizeof(fset)
+            hit = per_call(repeat, fset.__contains__, hits)
+            miss = per_call(repeat, fset.__contains__, misses)
+            batch = best_of(repeat, lambda: list(map(fset.__contains__, hits)))
+        else:
+            # list index misses land on None inside the span
+            probes = [k for k in misses if k < span] or hits
+            memory = sys.getsizeof(index)
+            hit = per_call(repeat, index.__getitem__, hits)
+            miss = per_call(repeat, index.__getitem__, probes)
+            batch = best_of(repeat, lambda: list(map(index.__getitem__, hits)))
+        print('  %-18s %8.2fms %8.1f %7.1fns %7.1fns %6.1fM/s' % (
+            name, elapsed * 1e3, memory / size, hit, miss, len(hits) / batch / 1e6))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--sizes', default=','.join(map(str, SIZES)))
+    parser.add_argument('--dists', default=','.join(DISTS))
+    parser.add_argument('--repeat', type=int, default=3)
+    args = parser.parse_args()
+
+    print('batch: ModDict.get_many over an array, the others map() over a list')
+    for dist in args.dists.split(','):
+        if dist not in DISTS:
+            parser.error('unknown distribution: %s' % dist)
+        for size in map(int, args.sizes.split(',')):
+            random.seed(size)
+            bench_one(dist, size, args.repeat)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+#
+# Lookup throughput of ModDict and dict read by 1, 2, 4, ... threads at
+# once.  Per-call lookups (get) scale only on a free-threaded build,
+# where the module leaves the GIL disabled; contains_many releases the
+# GIL for large buffers and scales either way.
+#
+#   python3 bench/threads.py [size [seconds]]
+#
+
+import array
+import glob
+import os
+import random
+import sys
+import threading
+import time
+from collections import deque
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+from ModDict import ModDict
+
+
+def run_threads(nthreads, work, count, seconds):
+    """returns lookups per second of nthreads running work for seconds"""
+    barrier = threading.Barrier(nthreads + 1)
+    done = [0] * nthreads
+    stop = []
+
+    def worker(index):
+        barrier.wait()
+        while not stop:
+            work()
+            done[index] += count
+
+    threads = [threading.Thread(target=worker, args=(n,)) for n in range(nthreads)]
+    for thread in threads:
+        thread.start()
+    barrier.wait()
+    start = time.perf_counter()
+    time.sleep(seconds)
+    stop.append(True)
+    for thread in threads:
+        thread.join()
+    return sum(done) / (time.perf_counter() - start)
+
+
+def main():
+    size = int(sys.argv[1]) if len(sys.argv) > 1 else 1000
+    seconds = float(sys.argv[2]) if len(sys.argv) > 2 else 1.0
+
+    random.seed(0)
+    keys = random.sample(range(1 << 20), size)
+    mapping = {k: n for n, k in enumerate(keys)}
+    mdict = ModDict(mapping)
+    probe = keys * max(1, 10000 // size)
+    buffer = array.array('I', keys * max(1, 100000 // size))
+
+    gil = getattr(sys, '_is_gil_enabled', lambda: True)()
+    ncpu = os.cpu_count() or 1
+    counts = [1]
+    while counts[-1] * 2 <= ncpu:
+        counts.append(counts[-1] * 2)
+
+    print('size=%d cpus=%d gil=%s' % (size, ncpu, 'enabled' if gil else 'disabled'))
+    rows = [
+        ('dict.get', lambda: deque(map(mapping.get, probe), 0), len(probe)),
+        ('ModDict.get', lambda: deque(map(mdict.get, probe), 0), len(probe)),
+        ('ModDict.contains_many', lambda: mdict.contains_many(buffer), len(buffer)),
+    ]
+    print('%-24s %8s %14s %8s' % ('', 'threads', 'lookups/s', 'scale'))
+    for name, work, count in rows:
+        base = None
+        for nthreads in counts:
+            rate = run_threads(nthreads, work, count, seconds)
+            base = base or rate
+            print('%-24s %8d %14.0f %7.2fx' % (name, nthreads, rate, rate / base))
+
+
+if __name__ == '__main__':
+    main()
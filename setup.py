@@ -1,7 +1,10 @@
 #!/usr/bin/env python3
 
 import os
-from distutils.core import setup, Extension
+try:
+    from distutils.core import setup, Extension
+except ImportError:     # Python 3.12 and later
+    from setuptools import setup, Extension
 
 def getenv(name, defval=None):
     if name in os.environ:
@@ -27,6 +30,10 @@ EXTRA_COMPILE_ARGS = [
     '-Wall',
     '-Wno-invalid-offsetof',
     '-Wno-deprecated-declarations',
+    '-pthread',
+]
+EXTRA_LINK_ARGS = [
+    '-pthread',
 ]
 
 if DEBUG:
@@ -43,4 +50,5 @@ setup(name='ModDict',
           define_macros=DEFINE_MACROS,
           undef_macros=UNDEF_MACROS,
           extra_compile_args=EXTRA_COMPILE_ARGS,
+          extra_link_args=EXTRA_LINK_ARGS,
           sources=['ModDict.c'])])
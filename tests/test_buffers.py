@@ -0,0 +1,293 @@
+#!/usr/bin/env python3
+#
+# The buffer side of ModDict: get_many, contains_many, from_buffers,
+# the tables handed out as memoryviews, and the remainders behind them
+# (fastmod, the multiply-shift engine and the SIMD kernels), checked
+# against Python's own arithmetic.
+#
+#   python3 -m unittest discover -s tests
+#   make test
+#
+
+import array
+import glob
+import os
+import random
+import sys
+import unittest
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+from ModDict import ModDict
+
+# ModDict_contains_buffer releases the GIL from here on
+NOGIL_THRESHOLD = 1 << 12
+
+
+def sample(count, bits=32, seed=7):
+    rand = random.Random(seed)
+    return rand.sample(range(1 << bits), count) if bits <= 32 else \
+        [rand.getrandbits(bits) for _ in range(count)]
+
+
+def keys_for(divisor, count, bits=32, seed=8):
+    """distinct remainders under divisor, spread over the key width"""
+    rand = random.Random(seed)
+    rems = rand.sample(range(divisor), count)
+    return [rem + divisor * rand.randrange(((1 << bits) - rem) // divisor) for rem in rems]
+
+
+def slot_function(m, bits=32):
+    """where the tables keep a key, as README's direct lookup describes"""
+    divisor, multiplier, buckets = m.divisor(), m.multiplier(), m.buckets()
+    if multiplier is not None:
+        shift = bits - divisor.bit_length() + 1
+        return lambda key: (key * multiplier % (1 << bits)) >> shift
+
+    def two_level(key):
+        bdivisor, offset = buckets[key % divisor]
+        return offset + key % bdivisor
+
+    return two_level if buckets is not None else lambda key: key % divisor
+
+
+class BufferTest(unittest.TestCase):
+
+    def assertContains(self, m, keys, probes):
+        present = set(keys)
+        expect = bytes(key in present for key in probes)
+        bits = bytearray((len(probes) + 7) // 8)
+        for pos, found in enumerate(expect):
+            bits[pos >> 3] |= found << (pos & 7)
+        buf = array.array('I', probes)
+        self.assertEqual(m.contains_many(buf), expect)
+        self.assertEqual(m.contains_many(buf, bitmap=True), bits)
+        out = bytearray(len(probes))
+        self.assertIs(m.contains_many(buf, out), out)
+        self.assertEqual(out, expect)
+        # one key at a time takes the scalar path
+        self.assertEqual(bytes(key in m for key in probes), expect)
+
+
+class GetManyTest(unittest.TestCase):
+
+    def setUp(self):
+        self.keys = sample(1000)
+        self.d = {key: pos - 500 for pos, key in enumerate(self.keys)}
+        self.probes = self.keys + [key + 1 for key in self.keys] + [0, (1 << 32) - 1]
+
+    def test_list(self):
+        for typed in (False, True):
+            m = ModDict(self.d, typed=typed)
+            with self.subTest(typed=typed):
+                self.assertEqual(m.get_many(self.probes),
+                                 [self.d.get(key) for key in self.probes])
+                self.assertEqual(m.get_many(self.probes + ['x', None, -1, 1 << 70], 'no'),
+                                 [self.d.get(key, 'no') for key in self.probes] + ['no'] * 4)
+                out = [None] * len(self.probes)
+                self.assertIs(m.get_many(self.probes, 0, out), out)
+                self.assertEqual(out, [self.d.get(key, 0) for key in self.probes])
+
+    def test_buffers(self):
+        expect = [self.d.get(key, -1) for key in self.probes]
+        for options in ({}, {'compact': True}, {'levels': 2}, {'engine': 'mul'}):
+            m = ModDict(self.d, typed=True, **options)
+            for fmt in 'IQlq':
+                with self.subTest(format=fmt, **options):
+                    keys = array.array(fmt, self.probes)
+                    self.assertEqual(m.get_many(keys, -1), expect)
+                    for outfmt in 'iq':
+                        out = array.array(outfmt, bytes(len(keys) * array.array(outfmt).itemsize))
+                        self.assertIs(m.get_many(keys, -1, out), out)
+                        self.assertEqual(out.tolist(), expect)
+
+    def test_narrow_and_signed_keys(self):
+        m = ModDict({1: 10, 5: 20, 200: 30}, typed=True)
+        for fmt in 'bBhHiI':
+            with self.subTest(format=fmt):
+                keys = array.array(fmt, [1, 2, 5, 100])
+                self.assertEqual(m.get_many(keys, -1), [10, -1, 20, -1])
+        self.assertEqual(m.get_many(array.array('i', [-1, 5]), -1), [-1, 20])
+
+    def test_errors(self):
+        m = ModDict({1: 10}, typed=True)
+        with self.assertRaisesRegex(ValueError, 'same length'):
+            m.get_many([1, 2], -1, [0])
+        with self.assertRaises(OverflowError):
+            m.get_many([1, 2], -1, array.array('Q', [0, 0]))
+        with self.assertRaisesRegex(TypeError, 'buffer format'):
+            m.get_many([1, 2], -1, array.array('d', [0, 0]))
+        with self.assertRaises(TypeError):
+            ModDict({1: 'a'}).get_many([1], -1, array.array('q', [0]))
+
+
+class ContainsManyTest(BufferTest):
+
+    def test_layouts(self):
+        keys = sample(1000)
+        probes = keys + [key ^ 1 for key in keys] + [0, (1 << 32) - 1]
+        for options in ({}, {'compact': True}, {'levels': 2}, {'engine': 'mul'},
+                        {'key_bits': 64}):
+            with self.subTest(**options):
+                self.assertContains(ModDict(keys, **options), keys, probes)
+
+    def test_kernel_tails(self):
+        # the vector kernels take 4 or 8 keys at a time, then finish one by one
+        keys = sample(500)
+        m = ModDict(keys)
+        probes = [key for pair in zip(keys, (key + 1 for key in keys)) for key in pair]
+        for length in range(0, 41):
+            with self.subTest(length=length):
+                self.assertContains(m, keys, probes[:length])
+
+    def test_without_gil(self):
+        keys = sample(2000)
+        rand = random.Random(9)
+        probes = [rand.choice(keys) if rand.random() < 0.5 else rand.getrandbits(32)
+                  for _ in range(NOGIL_THRESHOLD * 4 + 3)]
+        self.assertContains(ModDict(keys), keys, probes)
+
+    def test_hashed_and_empty(self):
+        self.assertEqual(ModDict(['a'], hashed=True).contains_many(array.array('I', [0, 1])),
+                         bytes(2))
+        self.assertEqual(ModDict([]).contains_many(array.array('I', [0, 1])), bytes(2))
+
+    def test_errors(self):
+        m = ModDict([1, 2])
+        with self.assertRaisesRegex(TypeError, 'integer buffer'):
+            m.contains_many([1, 2])
+        with self.assertRaisesRegex(ValueError, 'out must have 2 bytes'):
+            m.contains_many(array.array('I', [1, 2]), bytearray(1))
+
+
+class RemainderTest(BufferTest):
+    """every key sits where Python's arithmetic puts it"""
+
+    DIVISORS = (2, 3, 7, 64, 1000, 1021, 65536, 65537, 999983, 1 << 20, (1 << 20) + 1,
+                12345679)
+
+    def assertPlaced(self, m, keys, bits=32):
+        rem_keys, slot_of = m.rem_keys(), slot_function(m, bits)
+        for key in keys:
+            self.assertEqual(rem_keys[slot_of(key)], key, key)
+
+    def test_fastmod32(self):
+        for divisor in self.DIVISORS:
+            keys = keys_for(divisor, min(divisor, 300))
+            with self.subTest(divisor=divisor):
+                m = ModDict(keys, divisor=divisor)
+                self.assertEqual(m.divisor(), divisor)
+                self.assertPlaced(m, keys)
+                # same remainder, other key: the vector kernel compares the key
+                probes = keys + [key - divisor for key in keys if key >= divisor]
+                self.assertContains(m, keys, probes)
+
+    def test_fastmod64(self):
+        for divisor in self.DIVISORS:
+            keys = keys_for(divisor, min(divisor, 300), 64)
+            with self.subTest(divisor=divisor):
+                m = ModDict(keys, divisor=divisor, key_bits=64)
+                self.assertPlaced(m, keys, 64)
+                for key in keys:
+                    self.assertIn(key, m)
+                    self.assertNotIn(key ^ (1 << 63), m)
+                    if key >= divisor:
+                        self.assertNotIn(key - divisor, m)
+
+    def test_searched_divisors(self):
+        for bits in (32, 64):
+            keys = sample(1000, bits)
+            for options in ({}, {'threads': 4}, {'engine': 'mul'}):
+                with self.subTest(bits=bits, **options):
+                    self.assertPlaced(ModDict(keys, key_bits=bits, **options), keys, bits)
+
+    def test_two_levels(self):
+        keys = sample(2000)
+        self.assertPlaced(ModDict(keys, levels=2), keys)
+
+
+class TableTest(unittest.TestCase):
+
+    def test_views(self):
+        keys = sample(1000)
+        d = {key: pos * 3 for pos, key in enumerate(keys)}
+        for options in ({}, {'compact': True}, {'levels': 2}, {'engine': 'mul'},
+                        {'key_bits': 64}):
+            m = ModDict(d, typed=True, **options)
+            with self.subTest(**options):
+                rem_keys, remainder, numbers, order = (m.rem_keys(), m.remainder(),
+                                                       m.numbers(), m.order())
+                for view in (rem_keys, remainder, numbers):
+                    self.assertTrue(view.readonly)
+                self.assertEqual(rem_keys.format, 'Q' if options.get('key_bits') else 'I')
+                self.assertIn(remainder.format, 'HI')
+                self.assertIn(numbers.format, 'iq')
+                if options.get('compact'):
+                    self.assertIsNone(order)
+                    self.assertEqual(rem_keys.tolist(), keys)
+                    self.assertEqual(numbers.tolist(), list(d.values()))
+                else:
+                    self.assertEqual([rem_keys[slot] for slot in order], keys)
+                    self.assertEqual([numbers[slot] for slot in order], list(d.values()))
+                modkeys = m.modkeys()
+                self.assertEqual(len(remainder), len(modkeys))
+                for slot, index in enumerate(remainder):
+                    if index < len(m):
+                        self.assertEqual(keys[index], modkeys[slot])
+
+    def test_views_outlive_dict(self):
+        m = ModDict({7: 1, 9: 2}, typed=True)
+        rem_keys = m.rem_keys()
+        del m
+        self.assertEqual(set(rem_keys.tolist()), {7, 9})
+
+    def test_object_values(self):
+        self.assertIsNone(ModDict({1: 'a'}).numbers())
+
+
+class FromBuffersTest(unittest.TestCase):
+
+    def test_values(self):
+        keys = sample(1000)
+        values = [pos * 11 - 5000 for pos in range(1000)]
+        for fmt in 'iq':
+            with self.subTest(format=fmt):
+                m = ModDict.from_buffers(array.array('I', keys), array.array(fmt, values))
+                self.assertEqual(m.dict(), dict(zip(keys, values)))
+                self.assertIsNotNone(m.numbers())
+
+    def test_same_as_constructor(self):
+        keys = sample(1000) + [5, 5]
+        for options in ({}, {'compact': True}, {'levels': 2}, {'engine': 'mul'}):
+            with self.subTest(**options):
+                m = ModDict.from_buffers(array.array('I', keys), **options)
+                expect = ModDict(keys, **options)
+                self.assertEqual(m.dict(), expect.dict())
+                self.assertEqual(m.divisor(), expect.divisor())
+                self.assertEqual(ModDict.from_buffers(array.array('I', keys), value=3).dict(),
+                                 dict.fromkeys(keys, 3))
+
+    def test_duplicates_take_later_value(self):
+        m = ModDict.from_buffers(array.array('I', [3, 4, 3]), array.array('q', [7, 8, 9]))
+        self.assertEqual(m.dict(), {3: 9, 4: 8})
+
+    def test_key64(self):
+        keys = sample(500, 64)
+        m = ModDict.from_buffers(array.array('Q', keys), key_bits=64)
+        self.assertEqual(m.dict(), {key: pos for pos, key in enumerate(keys)})
+
+    def test_errors(self):
+        keys = array.array('I', [3, 4])
+        with self.assertRaisesRegex(TypeError, 'integer keys'):
+            ModDict.from_buffers(keys, hashed=True)
+        with self.assertRaisesRegex(ValueError, 'as long as keys'):
+            ModDict.from_buffers(keys, array.array('q', [1]))
+        with self.assertRaisesRegex(TypeError, 'not both'):
+            ModDict.from_buffers(keys, array.array('q', [1, 2]), value=1)
+        with self.assertRaises(TypeError):
+            ModDict.from_buffers(keys, array.array('d', [1, 2]))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+#
+# save() and load(), and load() of damaged files.
+#
+#   python3 -m unittest discover -s tests
+#   make test
+#
+
+import glob
+import os
+import random
+import struct
+import sys
+import tempfile
+import unittest
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+from ModDict import ModDict
+
+# ModDictFileHeader in ModDict.c
+HEADER = struct.Struct('=8s8IQ5Q5QQ')
+HEADER_V1 = HEADER.size - 8
+VERSION = 8
+FLAGS = 16
+SIZE = 40
+OFFSET = 48
+LENGTH = 88
+SECTIONS = 5
+REMAINDER, REM_KEYS, BUCKETS, NUMBERS, VALUES = range(SECTIONS)
+
+
+def sample(count, seed=1):
+    rand = random.Random(seed)
+    return rand.sample(range(1 << 30), count)
+
+
+def numbered(keys):
+    return {key: pos for pos, key in enumerate(keys)}
+
+
+class FileTest(unittest.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.TemporaryDirectory()
+        self.path = os.path.join(self.tmpdir.name, 'moddict.bin')
+
+    def tearDown(self):
+        self.tmpdir.cleanup()
+
+    def save(self, m):
+        m.save(self.path)
+        with open(self.path, 'rb') as f:
+            return bytearray(f.read())
+
+    def write(self, data):
+        with open(self.path, 'wb') as f:
+            f.write(data)
+
+    def assertLoads(self, m, **kwargs):
+        for mapped in (True, False):
+            with self.subTest(mmap=mapped):
+                loaded = ModDict.load(self.path, mapped, **kwargs)
+                self.assertEqual(loaded.dict(), m.dict())
+                self.assertEqual(loaded.divisor(), m.divisor())
+                self.assertEqual(list(loaded.keys()), list(m.keys()))
+
+    def assertCorrupt(self, data, message='corrupt ModDict file', **kwargs):
+        self.write(data)
+        for mapped in (True, False):
+            with self.subTest(mmap=mapped):
+                with self.assertRaisesRegex(ValueError, message):
+                    ModDict.load(self.path, mapped, **kwargs)
+
+    def put(self, data, pos, fmt, value):
+        struct.pack_into('=' + fmt, data, pos, value)
+
+    def get(self, data, pos, fmt):
+        return struct.unpack_from('=' + fmt, data, pos)[0]
+
+
+class SaveLoadTest(FileTest):
+
+    def test_typed(self):
+        keys = sample(1000)
+        for options in ({}, {'compact': True}, {'levels': 2}, {'levels': 2, 'compact': True},
+                        {'engine': 'mul'}):
+            with self.subTest(**options):
+                m = ModDict(numbered(keys), typed=True, **options)
+                self.save(m)
+                self.assertLoads(m)
+
+    def test_key64(self):
+        keys = [k << 20 | k for k in sample(500)]
+        for options in ({}, {'compact': True}, {'engine': 'mul'}):
+            with self.subTest(**options):
+                m = ModDict(numbered(keys), typed=True, key_bits=64, **options)
+                self.save(m)
+                self.assertLoads(m)
+
+    def test_objects_need_allow_pickle(self):
+        m = ModDict({k: str(k) for k in sample(100)})
+        self.save(m)
+        self.assertLoads(m, allow_pickle=True)
+        with self.assertRaisesRegex(ValueError, 'allow_pickle=True'):
+            ModDict.load(self.path)
+
+    def test_hashed_need_allow_pickle(self):
+        m = ModDict({'k%d' % n: n for n in range(300)}, hashed=True, typed=True)
+        self.save(m)
+        self.assertLoads(m, allow_pickle=True)
+        with self.assertRaisesRegex(ValueError, 'allow_pickle=True'):
+            ModDict.load(self.path, allow_pickle=False)
+
+    def test_empty(self):
+        m = ModDict({}, typed=True)
+        self.save(m)
+        self.assertLoads(m)
+
+    def test_version1(self):
+        # version 1 headers end before the multiplier
+        m = ModDict(numbered(sample(200)), typed=True)
+        data = self.save(m)
+        self.put(data, VERSION, 'I', 1)
+        self.write(data)
+        self.assertLoads(m)
+
+
+class DamagedFileTest(FileTest):
+
+    def setUp(self):
+        super().setUp()
+        self.data = self.save(ModDict(numbered(sample(1000)), typed=True))
+
+    def test_truncated(self):
+        data = self.data
+        for size in (0, 7, HEADER_V1 - 1, HEADER.size - 1):
+            with self.subTest(size=size):
+                self.assertCorrupt(data[:size], 'not a ModDict file|corrupt ModDict file')
+        for section in (REMAINDER, REM_KEYS, NUMBERS):
+            end = self.get(data, OFFSET + section * 8, 'Q') + \
+                  self.get(data, LENGTH + section * 8, 'Q')
+            with self.subTest(section=section):
+                self.assertCorrupt(data[:end - 1])
+
+    def test_bad_magic(self):
+        data = bytearray(self.data)
+        data[0:8] = b'MODDICX\0'
+        self.assertCorrupt(data, 'not a ModDict file')
+
+    def test_bad_version(self):
+        for version in (0, 3, 0xffffffff):
+            with self.subTest(version=version):
+                data = bytearray(self.data)
+                self.put(data, VERSION, 'I', version)
+                self.assertCorrupt(data, 'unsupported ModDict file version')
+
+    def test_unknown_flags(self):
+        data = bytearray(self.data)
+        self.put(data, FLAGS, 'I', 0x80)
+        self.assertCorrupt(data)
+
+    def test_size_beyond_table(self):
+        data = bytearray(self.data)
+        self.put(data, SIZE, 'Q', 1 << 40)
+        self.assertCorrupt(data)
+
+    def test_offset_out_of_range(self):
+        size = len(self.data)
+        for section in (REMAINDER, REM_KEYS, NUMBERS):
+            length = self.get(self.data, LENGTH + section * 8, 'Q')
+            # past the end, wrapping around, inside the header, misaligned
+            for offset in (size, size - length + 8, (1 << 64) - 8, 0, 8, HEADER.size - 8,
+                           self.get(self.data, OFFSET + section * 8, 'Q') + 1):
+                with self.subTest(section=section, offset=offset):
+                    data = bytearray(self.data)
+                    self.put(data, OFFSET + section * 8, 'Q', offset)
+                    self.assertCorrupt(data)
+
+    def test_length_mismatch(self):
+        for section in range(SECTIONS):
+            length = self.get(self.data, LENGTH + section * 8, 'Q')
+            for delta in (-8, 8):
+                if length + delta < 0:
+                    continue
+                with self.subTest(section=section, delta=delta):
+                    data = bytearray(self.data)
+                    self.put(data, LENGTH + section * 8, 'Q', length + delta)
+                    self.assertCorrupt(data)
+
+    def test_bad_remainder(self):
+        # a key left without its slot, and an index given to two slots
+        offset = self.get(self.data, OFFSET + REMAINDER * 8, 'Q')
+        slots = self.get(self.data, LENGTH + REMAINDER * 8, 'Q') // 4
+        used = [slot for slot in range(slots)
+                if self.get(self.data, offset + slot * 4, 'I') < 1000]
+        first = self.get(self.data, offset + used[0] * 4, 'I')
+        for slot, index in ((used[0], 1000), (used[1], first)):
+            with self.subTest(slot=slot, index=index):
+                data = bytearray(self.data)
+                self.put(data, offset + slot * 4, 'I', index)
+                self.assertCorrupt(data)
+
+    def test_bad_bucket_divisor(self):
+        # an empty bucket whose divisor runs past the table
+        m = ModDict(numbered(sample(1000)), typed=True, levels=2)
+        data = self.save(m)
+        divisor = m.divisor()
+        offset = self.get(data, OFFSET + BUCKETS * 8, 'Q')
+        itemsize = self.get(data, LENGTH + BUCKETS * 8, 'Q') // divisor
+        counts = [0] * divisor
+        for key in m.keys():
+            counts[key % divisor] += 1
+        pos = offset + counts.index(0) * itemsize + itemsize - 8
+        self.put(data, pos, 'I', 0x7fffffff)
+        self.assertCorrupt(data)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,286 @@
+#!/usr/bin/env python3
+#
+# ModDict as a mapping, checked against dict.
+#
+#   python3 -m unittest discover -s tests
+#   make test
+#
+
+import glob
+import os
+import pickle
+import random
+import sys
+import unittest
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+from ModDict import ModDict
+
+# table layouts every 32-bit key set is built with
+LAYOUTS = (
+    {},
+    {'compact': True},
+    {'levels': 2},
+    {'levels': 2, 'compact': True},
+    {'engine': 'mul'},
+    {'threads': 4},
+)
+
+
+def sample(count, bits=32, seed=5):
+    rand = random.Random(seed)
+    return [rand.getrandbits(bits) for _ in range(count)]
+
+
+def misses(keys, bits=32):
+    # near the keys, at the limits of the key width and beyond it
+    absent = {key + 1 for key in keys} | {key ^ (1 << (bits - 1)) for key in keys}
+    absent |= {0, 1, (1 << bits) - 1, 1 << bits, -1, 1 << 64}
+    return sorted(absent - set(keys), key=abs)
+
+
+class MappingTest(unittest.TestCase):
+
+    def assertSameMapping(self, m, d, probes):
+        self.assertEqual(len(m), len(d))
+        self.assertEqual(list(m), list(d))
+        self.assertEqual(m.dict(), d)
+        for key in probes:
+            self.assertEqual(key in m, key in d, key)
+            self.assertEqual(m.get(key), d.get(key), key)
+            self.assertEqual(m.get(key, 'absent'), d.get(key, 'absent'), key)
+            if key in d:
+                self.assertEqual(m[key], d[key], key)
+            else:
+                self.assertRaises(KeyError, m.__getitem__, key)
+
+    def test_layouts(self):
+        keys = sample(1000)
+        for options in LAYOUTS:
+            for typed in (False, True):
+                with self.subTest(typed=typed, **options):
+                    d = {key: pos * 7 - 3000 for pos, key in enumerate(keys)}
+                    m = ModDict(d, typed=typed, **options)
+                    self.assertSameMapping(m, d, keys + misses(keys))
+
+    def test_same_table_for_any_thread_count(self):
+        keys = sample(1000)
+        divisors = {ModDict(keys, threads=threads).divisor() for threads in (1, 2, 4, 0)}
+        self.assertEqual(len(divisors), 1)
+
+    def test_keys_and_value(self):
+        keys = [9, 4, 9, 1]
+        self.assertEqual(ModDict(keys).dict(), {9: 2, 4: 1, 1: 3})
+        self.assertEqual(ModDict(keys, 'v').dict(), {9: 'v', 4: 'v', 1: 'v'})
+
+    def test_empty(self):
+        for options in LAYOUTS:
+            with self.subTest(**options):
+                m = ModDict({}, **options)
+                self.assertSameMapping(m, {}, [0, 1, 5])
+
+    def test_typed_range(self):
+        d = {1: -1 << 63, 2: (1 << 63) - 1, 3: 0}
+        self.assertEqual(ModDict(d, typed=True).dict(), d)
+        with self.assertRaises(TypeError):
+            ModDict({1: 1 << 63}, typed=True)
+
+    def test_bad_keys(self):
+        for key in (-1, 1 << 32, 'a', 1.0, None):
+            with self.subTest(key=key):
+                with self.assertRaises(KeyError):
+                    ModDict([key])
+
+
+class ViewTest(unittest.TestCase):
+
+    def setUp(self):
+        self.d = {key: 'v%d' % key for key in sample(300)}
+        self.m = ModDict(self.d)
+
+    def test_iteration(self):
+        for view, expect in ((self.m.keys(), self.d.keys()), (self.m.values(), self.d.values()),
+                             (self.m.items(), self.d.items())):
+            with self.subTest(view=type(view).__name__):
+                self.assertEqual(len(view), len(expect))
+                self.assertEqual(list(view), list(expect))
+                it = iter(view)
+                self.assertEqual(it.__length_hint__(), len(expect))
+                next(it)
+                self.assertEqual(it.__length_hint__(), len(expect) - 1)
+
+    def test_contains(self):
+        key, value = next(iter(self.d.items()))
+        self.assertIn(key, self.m.keys())
+        self.assertNotIn(key + 1 if key + 1 not in self.d else -1, self.m.keys())
+        self.assertIn(value, self.m.values())
+        self.assertIn((key, value), self.m.items())
+        self.assertNotIn((key, 'other'), self.m.items())
+
+    def test_set_operations(self):
+        keys, items = self.d.keys(), self.d.items()
+        other = set(list(keys)[::2]) | {1, 2, 3}
+        other_items = set(list(items)[::3]) | {(1, 'x')}
+        other_dict = ModDict({key: self.d.get(key, 'w') for key in other})
+        for mview, dview, operand in ((self.m.keys(), keys, other),
+                                      (self.m.keys(), keys, other_dict.keys()),
+                                      (self.m.keys(), keys, other_dict),
+                                      (self.m.items(), items, other_items)):
+            expect = set(dict.fromkeys(operand)) if isinstance(operand, ModDict) else operand
+            with self.subTest(view=type(mview).__name__, operand=type(operand).__name__):
+                self.assertEqual(mview & operand, dview & expect)
+                self.assertEqual(mview | operand, dview | expect)
+                self.assertEqual(mview - operand, dview - expect)
+                self.assertEqual(mview ^ operand, dview ^ expect)
+        self.assertEqual(self.m.keys(), set(keys))
+        self.assertEqual(self.m.items(), set(items))
+        self.assertTrue(self.m.keys() <= set(keys) | {1})
+
+    def test_iterator_outlives_dict(self):
+        it = iter(ModDict({1: 2, 3: 4}).items())
+        self.assertEqual(list(it), [(1, 2), (3, 4)])
+        self.assertEqual(list(it), [])
+
+
+class PickleTest(unittest.TestCase):
+
+    def assertRoundTrip(self, m):
+        restored = pickle.loads(pickle.dumps(m))
+        self.assertIs(type(restored), ModDict)
+        self.assertEqual(restored.dict(), m.dict())
+        self.assertEqual(list(restored), list(m))
+        self.assertEqual(restored.divisor(), m.divisor())
+        self.assertEqual(restored.multiplier(), m.multiplier())
+        self.assertEqual(restored.buckets(), m.buckets())
+        self.assertEqual(restored.modkeys(), m.modkeys())
+        return restored
+
+    def test_layouts(self):
+        keys = sample(1000)
+        for options in LAYOUTS:
+            for typed in (False, True):
+                with self.subTest(typed=typed, **options):
+                    self.assertRoundTrip(ModDict(dict(zip(keys, range(1000))), typed=typed,
+                                                 **options))
+
+    def test_key64_and_hashed(self):
+        self.assertRoundTrip(ModDict(sample(500, 64), key_bits=64))
+        restored = self.assertRoundTrip(ModDict({'k%d' % n: n for n in range(500)},
+                                                hashed=True))
+        self.assertEqual(restored['k7'], 7)
+
+    def test_restore_reuses_divisor(self):
+        m = ModDict(sample(1000), typed=True)
+        restore, args = m.__reduce__()[:2]
+        self.assertEqual(restore.__name__, '_restore')
+        self.assertEqual(args[2]['divisor'], m.divisor())
+        args[2]['divisor'] = m.divisor() - 1
+        with self.assertRaisesRegex(ValueError, 'not injective'):
+            restore(*args)
+
+
+class WithChangesTest(unittest.TestCase):
+
+    def check(self, m, d, added=None, removed=None, probes=()):
+        changed = m.with_changes(added=added, removed=removed)
+        expect = dict(d)
+        for key in removed or ():
+            expect.pop(key, None)
+        expect.update(added or {})
+        self.assertEqual(changed.dict(), expect)
+        self.assertEqual(list(changed), list(expect))
+        self.assertEqual(m.dict(), d)
+        for key in list(expect) + list(probes):
+            self.assertEqual(changed.get(key), expect.get(key), key)
+        return changed
+
+    def test_layouts(self):
+        keys = sample(1000)
+        d = {key: pos for pos, key in enumerate(keys)}
+        added = {key: -key for key in sample(50, seed=6)}
+        for options in LAYOUTS:
+            for typed in (False, True):
+                with self.subTest(typed=typed, **options):
+                    m = ModDict(d, typed=typed, **options)
+                    self.check(m, d, added=added, removed=keys[::10] + [12345],
+                               probes=misses(keys))
+                    self.check(m, d, removed=keys, probes=keys)
+                    self.check(m, d, added={keys[0]: 'changed' if not typed else 99})
+                    changed = self.check(m, d)
+                    self.assertEqual(changed.divisor(), m.divisor())
+
+    def test_keeps_settings(self):
+        m = ModDict(sample(200, 64), key_bits=64, compact=True)
+        changed = self.check(m, m.dict(), added={1 << 63: 5})
+        self.assertEqual(changed.rem_keys().format, 'Q')
+        h = ModDict({'a': 1, 'b': 2}, hashed=True)
+        changed = self.check(h, h.dict(), added={b'a': 3}, removed=['b'], probes=['b', b'b'])
+        self.assertEqual(changed[b'a'], 3)
+
+
+class Key64Test(unittest.TestCase):
+
+    def test_lookups(self):
+        keys = sample(1000, 64) + [0, (1 << 64) - 1, 1 << 32, (1 << 32) - 1]
+        d = {key: pos for pos, key in enumerate(keys)}
+        for options in ({}, {'compact': True}, {'engine': 'mul'}, {'threads': 4}):
+            with self.subTest(**options):
+                m = ModDict(d, key_bits=64, **options)
+                for key in keys + misses(keys, 64):
+                    self.assertEqual(m.get(key), d.get(key), key)
+
+    def test_levels_two_refused(self):
+        with self.assertRaises(ValueError):
+            ModDict([1 << 40], key_bits=64, levels=2)
+
+    def test_32bit_table_refuses_wide_keys(self):
+        m = ModDict([5])
+        self.assertNotIn(5 + (1 << 32), m)
+        with self.assertRaises(KeyError):
+            ModDict([1 << 32])
+
+
+class HashedTest(unittest.TestCase):
+
+    def test_str_and_bytes(self):
+        d = {'k%d' % n: n for n in range(1000)}
+        d.update({b'b%d' % n: -n for n in range(1000)})
+        d[''] = 'empty'
+        d[b''] = 'empty bytes'
+        for options in ({}, {'compact': True}, {'key_bits': 64}, {'engine': 'mul'}):
+            with self.subTest(**options):
+                m = ModDict(d, hashed=True, **options)
+                self.assertEqual(m.dict(), d)
+                for key in ('k1', b'b1', '', b'', 'x', b'k1', 'b1', 1, None):
+                    self.assertEqual(m.get(key), d.get(key), key)
+
+    def test_seed(self):
+        keys = ['a', 'b', 'c']
+        m = ModDict(keys, hashed=True, seed=12345)
+        self.assertEqual(m.dict(), {'a': 0, 'b': 1, 'c': 2})
+        self.assertEqual(ModDict(keys, hashed=True, seed=12345).modkeys(), m.modkeys())
+
+
+class ForIndexTest(unittest.TestCase):
+
+    def test_same_for_list_dict_and_moddict(self):
+        keys = [7, 3, 100, 12]
+        expect = {k: n for n, k in enumerate(keys)}
+        for source in (keys, dict.fromkeys(keys, 'x'), ModDict(dict.fromkeys(keys, 'x')),
+                       iter(keys)):
+            with self.subTest(source=type(source).__name__):
+                self.assertEqual(dict(ModDict.forindex(source)), expect)
+
+    def test_repeated_keys_take_last_index(self):
+        self.assertEqual(dict(ModDict.forindex([3, 1, 3])), {3: 2, 1: 1})
+
+    def test_keeps_key_width_and_hashing(self):
+        self.assertEqual(dict(ModDict.forindex(ModDict([1 << 40], key_bits=64))), {1 << 40: 0})
+        self.assertEqual(dict(ModDict.forindex(ModDict(['x', 'y'], hashed=True))),
+                         {'x': 0, 'y': 1})
+
+
+if __name__ == '__main__':
+    unittest.main()
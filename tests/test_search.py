@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+#
+# Divisor search: its limits and the fallback to levels=2.
+#
+#   python3 -m unittest discover -s tests
+#   make test
+#
+
+import glob
+import os
+import random
+import sys
+import unittest
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+from ModDict import ModDict
+
+NO_TABLE = 'no table within max_load, timeout and prefer'
+# the deadline has passed by the time the clock is first read
+EXPIRED = 1e-9
+
+
+def sample(count, seed=3):
+    rand = random.Random(seed)
+    return rand.sample(range(1 << 31), count)
+
+
+class BudgetTest(unittest.TestCase):
+
+    def setUp(self):
+        self.keys = sample(2000)
+
+    def test_fallback_to_two_levels(self):
+        m = ModDict(self.keys, prefer='pow2', max_load=4)
+        self.assertIsNotNone(m.buckets())
+        self.assertEqual(sorted(m.keys()), sorted(self.keys))
+
+    def test_fallback_keeps_deadline(self):
+        # a few powers of two fail on max_load before the clock is read,
+        # so only the levels=2 fallback can run out of time
+        with self.assertRaisesRegex(ValueError, NO_TABLE):
+            ModDict(self.keys, prefer='pow2', max_load=4, timeout=EXPIRED)
+
+    def test_two_levels_keep_deadline(self):
+        with self.assertRaisesRegex(ValueError, NO_TABLE):
+            ModDict(self.keys, levels=2, timeout=EXPIRED)
+        m = ModDict(self.keys, levels=2, timeout=60)
+        self.assertEqual(sorted(m.keys()), sorted(self.keys))
+
+    def test_known_divisor_is_only_checked(self):
+        divisor = ModDict(self.keys, levels=2).divisor()
+        m = ModDict(self.keys, levels=2, divisor=divisor, timeout=EXPIRED)
+        self.assertEqual(m.divisor(), divisor)
+
+    def test_max_load(self):
+        with self.assertRaisesRegex(ValueError, NO_TABLE):
+            ModDict(self.keys, key_bits=64, max_load=1)
+
+
+if __name__ == '__main__':
+    unittest.main()
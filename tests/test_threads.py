@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+#
+# One ModDict read by several threads at once, checked against dict.
+# On a free-threaded build (3.13t) the lookups run without the GIL.
+#
+#   python3 -m unittest discover -s tests
+#   make test
+#
+
+import array
+import glob
+import os
+import random
+import sys
+import sysconfig
+import threading
+import unittest
+
+TOPDIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path[0:0] = glob.glob(os.path.join(TOPDIR, 'build', 'lib*'))
+
+from ModDict import ModDict
+
+FREE_THREADED = bool(sysconfig.get_config_var('Py_GIL_DISABLED'))
+THREADS = 8
+ROUNDS = 5
+
+
+def run_threads(target, count=THREADS):
+    barrier = threading.Barrier(count)
+    errors = []
+
+    def run(index):
+        barrier.wait()
+        try:
+            target(index)
+        except BaseException as error:
+            errors.append(error)
+
+    threads = [threading.Thread(target=run, args=(index,)) for index in range(count)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    if errors:
+        raise errors[0]
+
+
+class ThreadTest(unittest.TestCase):
+
+    @unittest.skipUnless(FREE_THREADED, 'not a free-threaded build')
+    def test_gil_stays_disabled(self):
+        # importing a module without Py_MOD_GIL_NOT_USED turns the GIL on
+        self.assertFalse(sys._is_gil_enabled())
+
+    def check_lookups(self, d, **options):
+        m = ModDict(d, **options)
+        rand = random.Random(0)
+        keys = list(d)
+        probes = keys + [rand.getrandbits(30) for _ in range(len(keys))]
+
+        def lookup(index):
+            order = probes[index::THREADS] + probes[:index]
+            for _ in range(ROUNDS):
+                for key in order:
+                    if m.get(key, None) != d.get(key, None) or (key in m) != (key in d):
+                        raise AssertionError(key)
+            if list(m.items()) != list(d.items()):
+                raise AssertionError('items')
+
+        run_threads(lookup)
+
+    def test_lookups(self):
+        rand = random.Random(1)
+        keys = rand.sample(range(1 << 30), 2000)
+        for options in ({}, {'compact': True}, {'levels': 2}, {'engine': 'mul'}):
+            with self.subTest(**options):
+                self.check_lookups({key: key * 3 for key in keys}, typed=True, **options)
+                self.check_lookups({key: str(key) for key in keys}, **options)
+
+    def test_hashed_lookups(self):
+        self.check_lookups({'k%d' % n: n for n in range(2000)}, hashed=True)
+
+    def test_buffer_lookups(self):
+        rand = random.Random(2)
+        keys = rand.sample(range(1 << 30), 5000)
+        d = {key: pos for pos, key in enumerate(keys)}
+        m = ModDict(d, typed=True, levels=2)
+        probes = array.array('I', keys + [rand.getrandbits(30) for _ in keys])
+        expect = array.array('q', [d.get(key, -1) for key in probes])
+        found = bytes(key in d for key in probes)
+
+        def lookup(index):
+            out = array.array('q', bytes(len(expect) * 8))
+            for _ in range(ROUNDS):
+                if m.get_many(probes, -1, out) != expect:
+                    raise AssertionError('get_many')
+                if m.contains_many(probes) != found:
+                    raise AssertionError('contains_many')
+
+        run_threads(lookup)
+
+    def test_shared_iterator(self):
+        # every key comes out of one iterator exactly once
+        keys = list(range(0, 300000, 3))
+        m = ModDict(dict.fromkeys(keys, 0), typed=True)
+        it = iter(m)
+        taken = [[] for _ in range(THREADS)]
+
+        def drain(index):
+            taken[index].extend(it)
+
+        run_threads(drain)
+        self.assertEqual(sorted(key for part in taken for key in part), keys)
+
+    def test_init_once(self):
+        m = ModDict({1: 2})
+        with self.assertRaises(TypeError):
+            m.__init__({3: 4})
+        self.assertEqual(m.dict(), {1: 2})
+
+
+if __name__ == '__main__':
+    unittest.main()